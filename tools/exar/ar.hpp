@@ -113,7 +113,9 @@ ed81
 namespace current {
 
 static constexpr std::string_view magic = "!<arch>\n";
+static constexpr std::string_view thin_magic = "!<thin>\n";
 static constexpr std::string_view extended = "#1/";
+static constexpr std::string_view gnu_names = "//";
 static constexpr std::string_view fmag = "`\n";
 
 struct ar_hdr {
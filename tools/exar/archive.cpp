@@ -0,0 +1,182 @@
+/* This file is part of Polyglot.
+
+  Copyright (C) 2024, Battelle Energy Alliance, LLC ALL RIGHTS RESERVED
+
+  Polyglot is free software; you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation; either version 3, or (at your option) any later version.
+
+  Polyglot is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  this software; if not see <http://www.gnu.org/licenses/>. */
+
+#include "archive.hpp"
+
+/*
+ * Everything in archive.hpp that isn't a class or a template, so that exar
+ * and libexar get one copy each.
+ */
+
+shared_input open_input(const fs::path& path)
+{
+    if (path == "-")
+        return std::make_shared<const input>(std::cin);
+    return std::make_shared<const input>(path);
+}
+
+shared_input open_archive(const fs::path& path)
+{
+    auto in = open_input(path);
+    auto kind = detect_compression(in->view(0, 4));
+    if (kind == compression::none)
+        return in;
+    return std::make_shared<const input>(decompress(kind, in->data()), path);
+}
+
+bool is_stream_input(const fs::path& path)
+{
+    struct stat st;
+    if (path == "-")
+        return true;
+    return (stat(path.c_str(), &st) == 0) && !S_ISREG(st.st_mode);
+}
+
+
+const std::set<std::string_view> format_files {
+    "__.SYMDEF",
+    "__.SYMDEF SORTED",
+    "__.SYMDEF_64",
+    "__.SYMDEF_64 SORTED",
+    "/",
+    "/SYM64/",
+    "//",
+};
+
+
+std::shared_ptr<::Archive> common::ancient::detect(shared_input is)
+{
+    return common::detect<Archive>(is);
+}
+
+std::shared_ptr<::Archive> common::old::detect(shared_input is)
+{
+    return common::detect<Archive>(is);
+}
+
+std::shared_ptr<::Archive> common::current::detect(shared_input is)
+{
+    return std::make_shared<Archive>(is);
+}
+
+std::shared_ptr<::Archive> common::current::thin::detect(shared_input is)
+{
+    return std::make_shared<Archive>(is);
+}
+
+std::shared_ptr<::Archive> bsd::old3::detect(shared_input is)
+{
+    return common::detect<Archive>(is);
+}
+
+
+std::map<std::string_view, format> formats = {
+    { "current",        make_format<common::current::Archive>(
+                            common::current::detect) },
+    // members are referred to by path, so this can't be streamed out
+    { "thin",           { common::current::thin::detect,
+                          common::current::thin::Archive::write,
+                          nullptr, nullptr } },
+    { "old",            make_format<common::old::Archive<endian::native>>(
+                            common::old::detect) },
+    { "old:little",     make_format<common::old::Archive<endian::little>>(
+                            common::old::detect) },
+    { "old:big",        make_format<common::old::Archive<endian::big>>(
+                            common::old::detect) },
+    { "old:mixed",      make_format<common::old::Archive<endian::mixed>>(
+                            common::old::detect) },
+    { "ancient",        make_format<common::ancient::Archive<endian::native>>(
+                            common::ancient::detect) },
+    { "ancient:little", make_format<common::ancient::Archive<endian::little>>(
+                            common::ancient::detect) },
+    { "ancient:big",    make_format<common::ancient::Archive<endian::big>>(
+                            common::ancient::detect) },
+    { "ancient:mixed",  make_format<common::ancient::Archive<endian::mixed>>(
+                            common::ancient::detect) },
+    { "bsd:old",        make_format<bsd::old3::Archive<endian::native>>(
+                            bsd::old3::detect) },
+    { "bsd:old:little", make_format<bsd::old3::Archive<endian::little>>(
+                            bsd::old3::detect) },
+    { "bsd:old:big",    make_format<bsd::old3::Archive<endian::big>>(
+                            bsd::old3::detect) },
+    { "bsd:old:mixed",  make_format<bsd::old3::Archive<endian::mixed>>(
+                            bsd::old3::detect) },
+};
+
+const std::vector<probe_entry> probes = [] {
+    using namespace common;
+    using enum endian;
+    return std::vector<probe_entry> {
+        make_probe<current::Archive>(
+            std::string { current::magic }, "current"),
+        make_probe<current::thin::Archive>(
+            std::string { current::thin_magic }, "thin"),
+        // these have to come before the 16-bit formats that share a prefix
+        make_probe<bsd::old3::Archive<little>>(
+            magic_bytes<little>(bsd::old3::magic), "bsd:old:little"),
+        make_probe<bsd::old3::Archive<big>>(
+            magic_bytes<big>(bsd::old3::magic), "bsd:old:big"),
+        make_probe<bsd::old3::Archive<mixed>>(
+            magic_bytes<mixed>(bsd::old3::magic), "bsd:old:mixed"),
+        make_probe<old::Archive<little>>(
+            magic_bytes<little>(old::magic), "old:little"),
+        make_probe<old::Archive<big>>(
+            magic_bytes<big>(old::magic), "old:big"),
+        make_probe<old::Archive<mixed>>(
+            magic_bytes<mixed>(old::magic), "old:mixed"),
+        make_probe<ancient::Archive<little>>(
+            magic_bytes<little>(ancient::magic), "ancient:little"),
+        make_probe<ancient::Archive<big>>(
+            magic_bytes<big>(ancient::magic), "ancient:big"),
+        make_probe<ancient::Archive<mixed>>(
+            magic_bytes<mixed>(ancient::magic), "ancient:mixed"),
+    };
+}();
+
+detection identify_format(shared_input is)
+{
+    detection best;
+    const probe_entry* winner = nullptr;
+    auto data = is->view(0, 8);
+    std::string_view head { (const char*)data.data(), data.size() };
+
+    for (auto& p : probes) {
+        if (!head.starts_with(p.magic))
+            continue;
+        auto score = p.probe(*is);
+        if (score > best.score) {
+            best.score = score;
+            best.format = p.format;
+            winner = &p;
+        }
+    }
+    if (winner) {
+        try {
+            best.archive = winner->make(is);
+        } catch (std::exception&) {
+            best = {};
+        }
+    }
+    return best;
+}
+
+shared_archive detect_any_format(shared_input is)
+{
+    auto found = identify_format(is);
+    if (!found)
+        throw std::system_error { EINVAL, std::generic_category(),
+                                  "unrecognized archive format" };
+    return found.archive;
+}
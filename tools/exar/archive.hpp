@@ -0,0 +1,2334 @@
+/* This file is part of Polyglot.
+ 
+  Copyright (C) 2024, Battelle Energy Alliance, LLC ALL RIGHTS RESERVED
+
+  Polyglot is free software; you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation; either version 3, or (at your option) any later version.
+
+  Polyglot is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  this software; if not see <http://www.gnu.org/licenses/>. */
+
+#include <iostream>
+#include <utility>
+#include <functional>
+#include <fstream>
+#include <ranges>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <set>
+#include <map>
+#include <vector>
+#include <filesystem>
+#include <cstdarg>
+#include <span>
+#include <system_error>
+#include <charconv>
+#include <array>
+#include <optional>
+#include <algorithm>
+#include <deque>
+#include <limits>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+
+#include "endian.hpp"
+#include "ar.hpp"
+#include "pool.hpp"
+#include "symbols.hpp"
+#include "scan.hpp"
+#include "compress.hpp"
+
+/*
+ * The archive formats themselves: reading inputs, writing outputs, the
+ * Archive hierarchy, and the registry of formats, for exar and libexar alike.
+ */
+
+namespace fs = std::filesystem;
+
+
+
+class Archive;
+using shared_archive = std::shared_ptr<Archive>;
+
+
+/*
+ * Read-only view of an input archive. Regular files are mapped straight into
+ * our address space so that parsing and copying members never needs an
+ * up-front copy or a seek per header; anything we can't map (pipes, character
+ * devices, etc.) falls back to draining a stream into a private buffer.
+ *
+ * The descriptor is closed as soon as the file is mapped, so that holding on
+ * to thousands of inputs doesn't run us out of them.
+ */
+class input
+{
+    fs::path _path;
+    dev_t _dev = 0;
+    ino_t _ino = 0;
+    void* _map = nullptr;
+    std::vector<std::byte> _buf;
+    std::span<const std::byte> _data;
+
+public:
+    input(const input&) = delete;
+    input& operator=(const input&) = delete;
+
+    explicit input(const fs::path& path)
+        : _path { path }
+    {
+        struct stat st;
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            throw std::system_error { errno, std::generic_category(),
+                                      path.string() };
+        if (fstat(fd, &st) < 0) {
+            int err = errno;
+            ::close(fd);
+            throw std::system_error { err, std::generic_category(),
+                                      path.string() };
+        }
+        if (S_ISREG(st.st_mode) && (st.st_size > 0)) {
+            _map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (_map != MAP_FAILED) {
+                _data = { (const std::byte*)_map, (size_t)st.st_size };
+                _dev = st.st_dev;
+                _ino = st.st_ino;
+                ::close(fd);
+                return;
+            }
+            _map = nullptr;
+        }
+        // not mappable, so fall back to reading it in through a stream
+        std::ifstream is { path, std::ios::in | std::ios::binary };
+        slurp(is);
+        ::close(fd);
+    }
+
+    explicit input(std::istream& is)
+    {
+        slurp(is);
+    }
+
+    explicit input(std::vector<std::byte>&& buf, const fs::path& path = {})
+        : _path { path }
+        , _buf { std::move(buf) }
+        , _data { _buf.data(), _buf.size() }
+    {}
+
+    ~input()
+    {
+        if (_map)
+            munmap(_map, _data.size());
+    }
+
+    const fs::path& path() const
+    {
+        return _path;
+    }
+
+    /* whether `fd` refers to the file we mapped (never, if we're buffered) */
+    bool same_file(int fd) const
+    {
+        struct stat st;
+        return _map && (fd >= 0) && (fstat(fd, &st) == 0)
+            && (st.st_dev == _dev) && (st.st_ino == _ino);
+    }
+
+    /* a new descriptor for the file we mapped, for the kernel to copy from;
+     * -1 if we're buffered, or it's been replaced since. Callers close it. */
+    int reopen() const
+    {
+        if (!_map)
+            return -1;
+        int fd = ::open(_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if ((fd >= 0) && !same_file(fd)) {
+            ::close(fd);
+            fd = -1;
+        }
+        return fd;
+    }
+
+    std::span<const std::byte> data() const
+    {
+        return _data;
+    }
+
+    size_t size() const
+    {
+        return _data.size();
+    }
+
+    /* bounds-clamped view of part of the input */
+    std::span<const std::byte> view(size_t offset, size_t size) const
+    {
+        if (offset >= _data.size())
+            return {};
+        return _data.subspan(offset, std::min(size, _data.size() - offset));
+    }
+
+private:
+    void slurp(std::istream& is)
+    {
+        char buf[65536];
+        while (is.read(buf, sizeof(buf)), is.gcount() > 0) {
+            auto p = (const std::byte*)buf;
+            _buf.insert(_buf.end(), p, p + is.gcount());
+        }
+        _data = { _buf.data(), _buf.size() };
+    }
+};
+
+using shared_input = std::shared_ptr<const input>;
+
+/* a file, or stdin for "-" */
+shared_input open_input(const fs::path& path);
+
+/* open an archive, seeing through any compression it's wrapped in */
+shared_input open_archive(const fs::path& path);
+
+/* true if `path` can only be read front to back (stdin, pipes, devices) */
+bool is_stream_input(const fs::path& path);
+
+
+/*
+ * Sequential sink for archive data. When backed by a file descriptor, member
+ * payloads are handed to the kernel to move from the input file to the output
+ * (copy_file_range, then sendfile), and only headers and padding are written
+ * from user space; when backed by a stream, everything goes through it.
+ *
+ * Nothing ever seeks, so the descriptor can just as well be a pipe or a
+ * socket. Headers and padding are collected in a buffer, and anything too big
+ * for it goes out together with what's pending in a single writev().
+ *
+ * The exception is updating a file in place, where what was there before is
+ * given too. For as long as the new contents keep members where they were,
+ * those are skipped, and only bytes that changed are kept aside. From the
+ * first member that moves, the rest goes to a scratch file, since it's still
+ * read from the range it will end up in. Nothing before the old end of the
+ * file is touched until finish() puts it all in place.
+ *
+ * Output can also be compressed on its way to the descriptor, in which case
+ * everything goes through user space, and each flush() ends a frame.
+ */
+class output
+{
+    std::ostream* _os = nullptr;
+    int _fd = -1;
+    bool _owned = false;
+    size_t _pos = 0;
+    std::unique_ptr<char[]> _buf;
+    size_t _capacity = 0;
+    size_t _used = 0;
+    // updating in place: the old contents, and whether we still match them
+    shared_input _previous;
+    bool _matching = false;
+    std::vector<std::pair<size_t, std::string>> _patches;
+    int _target = -1;
+    size_t _tail = 0;
+    // compressing: the encoder, and whether it's been fed since a flush
+    std::unique_ptr<codec> _encoder;
+    bool _encoded = false;
+#if defined(__linux__)
+    bool _use_cfr = true;
+    bool _use_sendfile = true;
+    // the file behind the last input the kernel copied from
+    int _source = -1;
+#endif
+
+public:
+    static constexpr size_t default_buffer = 1 << 20;
+
+    output(const output&) = delete;
+    output& operator=(const output&) = delete;
+
+    explicit output(const fs::path& path, mode_t mode = 0666,
+                    size_t buffer = default_buffer)
+        : _fd { ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                       mode) }
+        , _owned { true }
+        , _capacity { buffer }
+    {
+        if (_fd < 0)
+            throw std::system_error { errno, std::generic_category(),
+                                      path.string() };
+    }
+
+    explicit output(int fd, size_t buffer = default_buffer)
+        : _fd { fd }
+        , _capacity { buffer }
+    {}
+
+    explicit output(std::ostream& os)
+        : _os { &os }
+    {}
+
+    /* rewrite the file `fd` refers to, which currently holds `previous` */
+    output(int fd, shared_input previous, size_t buffer = default_buffer)
+        : _fd { fd }
+        , _capacity { buffer }
+        , _previous { previous }
+        , _matching { true }
+    {}
+
+    /* anything still buffered here is written out, but errors can't be
+     * reported from a destructor, so callers that care should flush() */
+    ~output()
+    {
+        try {
+            flush();
+        } catch (std::exception&) {
+        }
+        if (_owned)
+            ::close(_fd);
+        if (_target >= 0)
+            ::close(_fd);
+#if defined(__linux__)
+        if (_source >= 0)
+            ::close(_source);
+#endif
+        // an update that never finished leaves the file as it was
+        if (_previous)
+            (void)!ftruncate((_target >= 0) ? _target : _fd,
+                             _previous->size());
+    }
+
+    /* compress everything written from now on */
+    void compress(compression kind, size_t threads)
+    {
+        send({});
+        _encoder = make_encoder(kind, threads);
+    }
+
+    /* push out anything we've been holding on to */
+    void flush()
+    {
+        if (_os) {
+            if (!_os->flush())
+                throw std::system_error { EIO, std::generic_category(),
+                                          "write" };
+            return;
+        }
+        send({});
+        if (_encoder && _encoded)
+            encode({}, true);
+    }
+
+    /* done updating in place: put back what moved, and drop what's left */
+    void finish()
+    {
+        flush();
+        for (auto& [offset, bytes] : _patches)
+            write_at(_target >= 0 ? _target : _fd, bytes.data(), bytes.size(),
+                     offset);
+        if (_target >= 0) {
+            auto buf = std::make_unique_for_overwrite<char[]>(1 << 20);
+            for (size_t off = 0; off < _pos - _tail; ) {
+                auto len = pread(_fd, buf.get(), 1 << 20, off);
+                if ((len < 0) && (errno == EINTR))
+                    continue;
+                if (len <= 0)
+                    throw std::system_error { len ? errno : EIO,
+                                              std::generic_category(),
+                                              "read" };
+                write_at(_target, buf.get(), len, _tail + off);
+                off += len;
+            }
+            ::close(_fd);
+            _fd = _target;
+            _target = -1;
+        }
+        if (_previous && (ftruncate(_fd, _pos) < 0))
+            throw std::system_error { errno, std::generic_category(),
+                                      "truncate" };
+        _previous.reset();
+        _matching = false;
+    }
+
+    /* preallocate space for an output we know the final size of */
+    void reserve(size_t size)
+    {
+        if ((_fd < 0) || !size || _encoder)
+            return;
+#if defined(__linux__)
+        // this is purely advisory, so filesystems without support are fine
+        while ((fallocate(_fd, 0, 0, size) < 0) && (errno == EINTR))
+            ;
+#endif
+    }
+
+    /* number of bytes written through this output so far */
+    size_t tell() const
+    {
+        return _pos;
+    }
+
+    void write(const void* buf, size_t size)
+    {
+        if (_matching) {
+            // only what's different needs to go anywhere
+            auto old = _previous->view(_pos, size);
+            if ((old.size() != size) || memcmp(old.data(), buf, size)) {
+                if (_patches.empty() || (_patches.back().first
+                                         + _patches.back().second.size()
+                                         != _pos))
+                    _patches.emplace_back(_pos, std::string {});
+                _patches.back().second.append((const char*)buf, size);
+            }
+            _pos += size;
+            return;
+        }
+        if (_os) {
+            _os->write((const char*)buf, size);
+            if (!*_os)
+                throw std::system_error { EIO, std::generic_category(),
+                                          "write" };
+            _pos += size;
+            return;
+        }
+        if (size < _capacity - _used) {
+            if (!_buf)
+                _buf = std::make_unique_for_overwrite<char[]>(_capacity);
+            memcpy(_buf.get() + _used, buf, size);
+            _used += size;
+        } else {
+            send({ (const std::byte*)buf, size });
+        }
+        _pos += size;
+    }
+
+    void write(std::span<const std::byte> data)
+    {
+        write(data.data(), data.size());
+    }
+
+    void write(std::string_view sv)
+    {
+        write(sv.data(), sv.size());
+    }
+
+    /* write `size` zero bytes */
+    void pad(size_t size)
+    {
+        static const char zeros[4096] = {};
+        while (size) {
+            auto len = std::min(size, sizeof(zeros));
+            write(zeros, len);
+            size -= len;
+        }
+    }
+
+    /* copy part of an input to the output, avoiding user space if we can */
+    void copy_from(const input& in, size_t offset, size_t size)
+    {
+        auto data = in.view(offset, size);
+        if (_matching) {
+            if ((&in == _previous.get()) && (offset == _pos)) {
+                // a member that's staying put
+                _pos += data.size();
+                pad(size - data.size());
+                return;
+            }
+            diverge();
+        }
+#if defined(__linux__)
+        if ((_fd >= 0) && data.size() && !_encoder
+                && (_use_cfr || _use_sendfile) && source(in)) {
+            // the kernel copies go straight to the file, so catch it up first
+            send({});
+            loff_t off = offset;
+            size_t remain = data.size();
+            while (remain && _use_cfr) {
+                auto len = copy_file_range(_source, &off, _fd, nullptr,
+                                           remain, 0);
+                if (len > 0) {
+                    remain -= len;
+                    _pos += len;
+                } else if ((len < 0) && (errno == EINTR)) {
+                    continue;
+                } else if (len < 0 && (errno == EXDEV || errno == EINVAL
+                                    || errno == ENOSYS || errno == EOPNOTSUPP
+                                    || errno == EBADF)) {
+                    _use_cfr = false;
+                } else if (len < 0) {
+                    throw std::system_error { errno, std::generic_category(),
+                                              "copy_file_range" };
+                } else {
+                    break;
+                }
+            }
+            while (remain && _use_sendfile) {
+                off_t soff = off;
+                auto len = sendfile(_fd, _source, &soff, remain);
+                if (len > 0) {
+                    off = soff;
+                    remain -= len;
+                    _pos += len;
+                } else if ((len < 0) && (errno == EINTR)) {
+                    continue;
+                } else if (len < 0 && (errno == EINVAL || errno == ENOSYS)) {
+                    _use_sendfile = false;
+                } else if (len < 0) {
+                    throw std::system_error { errno, std::generic_category(),
+                                              "sendfile" };
+                } else {
+                    break;
+                }
+            }
+            data = data.subspan(data.size() - remain);
+        }
+#endif
+        // the data is already in memory, so one big write does the trick
+        write(data);
+        // pad out anything that ran off the end of a truncated input
+        pad(size - in.view(offset, size).size());
+    }
+
+private:
+#if defined(__linux__)
+    /* point _source at the file `in` maps, reopening it only when that's a
+     * different file from last time; members mostly come in runs */
+    bool source(const input& in)
+    {
+        if (in.same_file(_source))
+            return true;
+        if (_source >= 0)
+            ::close(_source);
+        _source = in.reopen();
+        return _source >= 0;
+    }
+#endif
+
+    static void write_at(int fd, const void* buf, size_t size, size_t offset)
+    {
+        while (size) {
+            auto len = pwrite(fd, buf, size, offset);
+            if (len < 0) {
+                if (errno == EINTR)
+                    continue;
+                throw std::system_error { errno, std::generic_category(),
+                                          "write" };
+            }
+            buf = (const char*)buf + len;
+            size -= len;
+            offset += len;
+        }
+    }
+
+    /* stop matching the old contents, and carry on writing sequentially */
+    void diverge()
+    {
+        _matching = false;
+        if (_pos >= _previous->size()) {
+            // past the end, nothing we could still need gets overwritten
+            if (lseek(_fd, _pos, SEEK_SET) < 0)
+                throw std::system_error { errno, std::generic_category(),
+                                          "seek" };
+            return;
+        }
+        auto dir = _previous->path().parent_path();
+        auto path = (dir.empty() ? fs::path { "." } : dir) / ".exar.XXXXXX";
+        auto name = path.string();
+        int fd = mkostemp(name.data(), O_CLOEXEC);
+        if (fd < 0)
+            throw std::system_error { errno, std::generic_category(), name };
+        ::unlink(name.c_str());
+        _target = _fd;
+        _fd = fd;
+        _tail = _pos;
+    }
+
+    /* compress `data` out to the descriptor, ending the frame if asked */
+    void encode(std::span<const std::byte> data, bool end)
+    {
+        auto out = std::make_unique_for_overwrite<std::byte[]>(1 << 17);
+        for (;;) {
+            auto p = _encoder->run(data, { out.get(), 1 << 17 }, end);
+            data = data.subspan(p.consumed);
+            for (size_t done = 0; done < p.produced; ) {
+                auto len = ::write(_fd, out.get() + done, p.produced - done);
+                if ((len < 0) && (errno != EINTR))
+                    throw std::system_error { errno, std::generic_category(),
+                                              "write" };
+                done += std::max<ssize_t>(len, 0);
+            }
+            if (end ? p.done : data.empty())
+                break;
+        }
+        _encoded = !end;
+    }
+
+    /* write whatever is buffered followed by `data`, bypassing the buffer */
+    void send(std::span<const std::byte> data)
+    {
+        if (_encoder) {
+            if (_used)
+                encode({ (const std::byte*)_buf.get(), _used }, false);
+            if (!data.empty())
+                encode(data, false);
+            _used = 0;
+            return;
+        }
+        iovec iov[2] = {
+            { _buf.get(), _used },
+            { (void*)data.data(), data.size() },
+        };
+        iovec* vec = iov;
+        int count = 2;
+        while (count) {
+            // step past anything that's gone out, including empty vectors
+            if (!vec->iov_len) {
+                ++vec;
+                --count;
+                continue;
+            }
+            auto len = ::writev(_fd, vec, count);
+            if (len < 0) {
+                if (errno == EINTR)
+                    continue;
+                throw std::system_error { errno, std::generic_category(),
+                                          "write" };
+            }
+            while (count && ((size_t)len >= vec->iov_len)) {
+                len -= vec->iov_len;
+                ++vec;
+                --count;
+            }
+            if (count) {
+                vec->iov_base = (char*)vec->iov_base + len;
+                vec->iov_len -= len;
+            }
+        }
+        _used = 0;
+    }
+};
+
+
+constexpr size_t align(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+
+template <class T>
+struct format_arg
+{
+    static auto get(const T& value)
+    {
+        return value;
+    }
+
+    static auto get(T&& value)
+    {
+        return std::forward<T>(value);
+    }
+};
+
+template <>
+struct format_arg<std::string>
+{
+    static auto get(const std::string& value)
+    {
+        return value.c_str();
+    }
+};
+
+template <>
+struct format_arg<std::string_view>
+{
+    static auto get(std::string_view value)
+    {
+        return value.data();
+    }
+};
+
+template <size_t N, class... Args>
+void __attribute__((format(printf, 2, 3)))
+    format_field(char (&field)[N], const char* format, ...)
+{
+    va_list ap;
+    char buf[N+1];
+    memset(buf, 0, sizeof(buf));
+    va_start(ap, format);
+    vsnprintf(buf, sizeof(buf), format, ap);
+    va_end(ap);
+    memcpy(field, buf, std::min(strnlen(buf, sizeof(buf)), N));
+}
+
+
+template <class T, char End, size_t Base, size_t N>
+struct field_parser;
+
+template <char End, size_t Base, size_t N>
+struct field_parser<std::string_view, End, Base, N>
+{
+    static std::string_view parse(const char (&buf)[N])
+    {
+        constexpr auto npos = std::string_view::npos;
+        if constexpr (End == 0) {
+            return { buf, strnlen(buf, N) };
+        } else {
+            std::string_view sv = { buf, N };
+            auto p = sv.find(End);
+            return { p == npos ? sv : sv.substr(0, p) };
+        }
+    }
+};
+
+template <char End, size_t Base, size_t N>
+struct field_parser<std::string, End, Base, N>
+{
+    static std::string parse(const char (&buf)[N])
+    {
+        return std::string { field_parser<std::string_view, End, Base, N>::parse(buf) };
+    }
+};
+
+/*
+ * Numeric fields are parsed in place with std::from_chars: no temporary
+ * strings, no locale, and no exceptions unless the caller asks for them.
+ * `try_parse` reports problems as a std::errc (invalid_argument for an empty
+ * or non-numeric field, result_out_of_range if it doesn't fit in I), and
+ * `parse` turns those into a std::system_error.
+ */
+template <std::integral I, char End, size_t Base, size_t N>
+struct field_parser<I, End, Base, N>
+{
+    static std::errc try_parse(const char (&buf)[N], I& value)
+    {
+        auto sv = field_parser<std::string_view, End, Base, N>::parse(buf);
+        // match strto*(), which tolerate leading blanks
+        auto first = sv.find_first_not_of(' ');
+        if (first == std::string_view::npos)
+            return std::errc::invalid_argument;
+        sv.remove_prefix(first);
+        auto [p, ec] = std::from_chars(sv.data(), sv.data() + sv.size(),
+                                       value, Base);
+        if (ec != std::errc {})
+            return ec;
+        if (p != sv.data() + sv.size())
+            return std::errc::invalid_argument;
+        return {};
+    }
+
+    static I parse(const char (&buf)[N])
+    {
+        I value;
+        auto ec = try_parse(buf, value);
+        if (ec != std::errc {})
+            throw std::system_error { std::make_error_code(ec),
+                                      "malformed header field" };
+        return value;
+    }
+};
+
+template <class T = std::string_view, char End = 0, size_t Base = 10, size_t N>
+auto parse_field(const char (&buf)[N])
+{
+    return field_parser<T, End, Base, N>::parse(buf);
+}
+
+template <char End = 0, size_t Base = 10, class T = std::string_view, size_t N>
+void parse_field_into(T* field, const char (&buf)[N])
+{
+    *field = field_parser<T, End, Base, N>::parse(buf);
+}
+
+template <char End = 0, size_t Base = 10, std::integral T, size_t N>
+std::errc try_parse_field_into(T* field, const char (&buf)[N])
+{
+    return field_parser<T, End, Base, N>::try_parse(buf, *field);
+}
+
+template <size_t N>
+void write_stringstream_into_field(char (&field)[N], std::stringstream ss)
+{
+    auto s = ss.str();
+    memcpy(field, s.data(), std::min(N, s.size()));
+}
+
+/*
+ * One member, as a view: the name, the path and the input all belong to
+ * whatever the entry came from (an archive's member table, or the buffers
+ * of whoever is parsing headers), and are only good for as long as it is.
+ */
+struct entry
+{
+    const ::input* input;
+    size_t header_offset;
+    size_t content_offset;
+    size_t content_size;
+
+    std::string_view name;
+    unsigned long date;
+    unsigned uid;
+    unsigned gid;
+    unsigned mode;
+
+    // members of thin archives: the file that really holds the content
+    std::string_view external;
+
+    /* the name to store the member under in a regular archive: thin ones
+     * name members by path, but a stored member is just a file */
+    std::string_view member_name() const
+    {
+        std::string_view sv { name };
+        if (external.empty())
+            return sv;
+        return sv.substr(sv.rfind('/') + 1);
+    }
+
+    /* content stored in the archive itself (so never for external members) */
+    std::span<const std::byte> content() const
+    {
+        return input->view(content_offset, content_size);
+    }
+
+    /* wherever the content lives, opening external files as needed; stored
+     * content is still owned by the archive, so this doesn't keep it alive */
+    shared_input source() const
+    {
+        if (external.empty())
+            return shared_input { shared_input {}, input };
+        return open_input(fs::path { external });
+    }
+
+    void copy_content_to(output& out, size_t alignment = 1) const
+    {
+        out.copy_from(*source(), content_offset, content_size);
+        out.pad(content_size % alignment);
+    }
+};
+
+/* members that only hold an archive's own bookkeeping */
+extern const std::set<std::string_view> format_files;
+
+enum class symbol_index
+{
+    none,
+    gnu,
+    bsd,
+};
+
+/* how current format archives store names that don't fit in the header */
+enum class long_names
+{
+    gnu,    // one shared "//" table, referred to as "/<offset>"
+    bsd,    // "#1/<length>", with the name at the start of the member
+};
+
+/* knobs for the archive writers; formats ignore what they can't express */
+struct write_options
+{
+    symbol_index index = symbol_index::gnu;
+    long_names names = long_names::gnu;
+    // where the archive is going; thin archives refer to members from here
+    fs::path base = ".";
+    /* for each of the archive's members, the index of the first one with
+     * identical content; empty keeps every member as it is */
+    std::vector<size_t> originals;
+
+    bool duplicate(size_t member) const
+    {
+        return !originals.empty() && (originals[member] != member);
+    }
+};
+
+/*
+ * Open-addressed (linear probing) map from member name to its position in an
+ * archive's header table, so looking up k members after one header walk costs
+ * O(k) rather than a scan of the whole table per name. Where an archive holds
+ * several members with the same name, the first one wins.
+ */
+class member_index
+{
+    struct slot
+    {
+        uint64_t hash;
+        size_t index;   // position in the header table, plus one (0 = empty)
+    };
+
+    std::vector<slot> slots;
+    size_t count = 0;
+
+    static uint64_t hash(std::string_view name)
+    {
+        // FNV-1a
+        uint64_t h = 0xcbf29ce484222325;
+        for (unsigned char c : name)
+            h = (h ^ c) * 0x100000001b3;
+        return h;
+    }
+
+    void grow()
+    {
+        auto old = std::move(slots);
+        slots.assign(std::max<size_t>(16, old.size() * 2), slot {});
+        for (auto& s : old) {
+            if (!s.index)
+                continue;
+            auto mask = slots.size() - 1;
+            auto i = s.hash & mask;
+            while (slots[i].index)
+                i = (i + 1) & mask;
+            slots[i] = s;
+        }
+    }
+
+public:
+    /* returns false (and changes nothing) if the name is already present */
+    template <class Lookup>
+    bool insert(std::string_view name, size_t index, Lookup&& name_of)
+    {
+        if ((count + 1) * 2 > slots.size())
+            grow();
+        auto h = hash(name);
+        auto mask = slots.size() - 1;
+        auto i = h & mask;
+        for (; slots[i].index; i = (i + 1) & mask) {
+            if ((slots[i].hash == h) && (name_of(slots[i].index - 1) == name))
+                return false;
+        }
+        slots[i] = { h, index + 1 };
+        ++count;
+        return true;
+    }
+
+    template <class Lookup>
+    std::optional<size_t> find(std::string_view name, Lookup&& name_of) const
+    {
+        if (slots.empty())
+            return {};
+        auto h = hash(name);
+        auto mask = slots.size() - 1;
+        for (auto i = h & mask; slots[i].index; i = (i + 1) & mask) {
+            if ((slots[i].hash == h) && (name_of(slots[i].index - 1) == name))
+                return slots[i].index - 1;
+        }
+        return {};
+    }
+};
+
+/*
+ * An archive's header table, one array per field, with every name and path
+ * copied into a single pool. A member costs a few dozen bytes instead of an
+ * entry full of strings, and walking one field stays in cache. Rows come
+ * back out as entries viewing the pool, good until the next push_back().
+ */
+class member_table
+{
+    // a string in the pool
+    struct text
+    {
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    // inputs are nearly always shared by every row, so rows just number them
+    std::vector<const ::input*> sources;
+    std::vector<uint32_t> source;
+    std::vector<uint64_t> header_offset;
+    std::vector<uint64_t> content_offset;
+    std::vector<uint64_t> content_size;
+    std::vector<uint64_t> date;
+    std::vector<uint32_t> uid;
+    std::vector<uint32_t> gid;
+    std::vector<uint32_t> mode;
+    std::vector<text> name;
+    std::vector<text> external;
+    std::string pool;
+
+    text intern(std::string_view value)
+    {
+        if (pool.size() + value.size() > std::numeric_limits<uint32_t>::max())
+            throw std::system_error { EFBIG, std::generic_category(),
+                                      "member names" };
+        text t { (uint32_t)pool.size(), (uint32_t)value.size() };
+        pool.append(value);
+        return t;
+    }
+
+    std::string_view view(text t) const
+    {
+        return { pool.data() + t.offset, t.size };
+    }
+
+public:
+    size_t size() const
+    {
+        return name.size();
+    }
+
+    void push_back(const entry& ent)
+    {
+        if (sources.empty() || (sources.back() != ent.input))
+            sources.push_back(ent.input);
+        source.push_back(sources.size() - 1);
+        header_offset.push_back(ent.header_offset);
+        content_offset.push_back(ent.content_offset);
+        content_size.push_back(ent.content_size);
+        date.push_back(ent.date);
+        uid.push_back(ent.uid);
+        gid.push_back(ent.gid);
+        mode.push_back(ent.mode);
+        name.push_back(intern(ent.name));
+        external.push_back(intern(ent.external));
+    }
+
+    std::string_view name_of(size_t i) const
+    {
+        return view(name[i]);
+    }
+
+    entry operator[](size_t i) const
+    {
+        return { sources[source[i]], header_offset[i], content_offset[i],
+                 content_size[i], view(name[i]), date[i], uid[i], gid[i],
+                 mode[i], view(external[i]) };
+    }
+};
+
+class Archive
+{
+protected:
+    shared_input input;
+    member_table headers;
+    // rows of the table holding real members, and the format's own
+    std::vector<uint32_t> members;
+    std::vector<uint32_t> format_members;
+    member_index index;
+
+    /* record a parsed header, indexing it by name if it's a real member; the
+     * entry's strings are copied, so they only have to last until then */
+    void add_header(const entry& ent)
+    {
+        auto row = headers.size();
+        headers.push_back(ent);
+        if (format_files.contains(ent.name)) {
+            format_members.push_back(row);
+        } else {
+            members.push_back(row);
+            index.insert(ent.name, row, [this](size_t i) {
+                return headers.name_of(i);
+            });
+        }
+    }
+
+    auto rows(const std::vector<uint32_t>& which) const
+    {
+        return which | std::views::transform([this](size_t i) {
+            return headers[i];
+        });
+    }
+
+    template <std::integral I>
+    bool check_magic(I magic)
+    {
+        I value;
+
+        if (input->size() < sizeof(value))
+            return false;
+        memcpy(&value, input->data().data(), sizeof(value));
+
+        return (swap_endian<endian::little>(value) == magic)
+            || (swap_endian<endian::big   >(value) == magic)
+            || (swap_endian<endian::mixed >(value) == magic);
+    }
+
+    bool check_magic(std::string_view magic)
+    {
+        auto data = input->view(0, magic.size());
+        std::string_view value { (const char*)data.data(), data.size() };
+
+        return value == magic;
+    }
+
+    /* copy a fixed-size structure out of an input without throwing */
+    template <class T>
+    static bool peek(const ::input& in, size_t offset, T& value)
+    {
+        auto data = in.view(offset, sizeof(value));
+        if (data.size() != sizeof(value))
+            return false;
+        memcpy((void*)&value, data.data(), sizeof(value));
+        return true;
+    }
+
+    /* copy a fixed-size structure out of the input at the given offset */
+    template <class T>
+    void read_at(size_t offset, T& value) const
+    {
+        if (!peek(*input, offset, value))
+            throw std::exception {};
+    }
+
+public:
+    Archive(shared_input input)
+        : input { input }
+    {}
+
+    virtual std::string description() const
+    {
+        return "unknown archive format";
+    }
+
+    auto get_members() const
+    {
+        return rows(members);
+    }
+
+    /* every header, in archive order, format members and all */
+    auto get_headers() const
+    {
+        return std::views::iota(size_t { 0 }, headers.size())
+            | std::views::transform([this](size_t i) { return headers[i]; });
+    }
+
+    /* the members that are part of the format (symbol indexes, name tables) */
+    auto get_format_members() const
+    {
+        return rows(format_members);
+    }
+
+    /* look up a member by name */
+    std::optional<entry> find_member(std::string_view name) const
+    {
+        auto i = index.find(name, [this](size_t i) {
+            return headers.name_of(i);
+        });
+        if (!i)
+            return {};
+        return headers[*i];
+    }
+};
+
+
+namespace common {
+
+template <class T> concept has_name = requires (T&& h) { h.ar_name; };
+template <class T> concept has_date = requires (T&& h) { h.ar_date; };
+template <class T> concept has_uid  = requires (T&& h) { h.ar_uid;  };
+template <class T> concept has_gid  = requires (T&& h) { h.ar_gid;  };
+template <class T> concept has_mode = requires (T&& h) { h.ar_mode; };
+template <class T> concept has_size = requires (T&& h) { h.ar_size; };
+
+template <auto Magic,
+          class Header,
+          size_t Alignment,
+          endian Endian>
+class Archive
+    : public ::Archive
+{
+public:
+    using header_type = Header;
+    static constexpr auto alignment = Alignment;
+    static constexpr auto endianness = Endian;
+    static constexpr auto magic = Magic;
+
+    Archive(shared_input input)
+        : ::Archive { input }
+    {
+        if (!check_magic(magic))
+            throw std::exception {};
+        read_headers();
+    }
+
+    virtual std::string description() const
+    {
+        std::stringstream ss;
+        ss << "unknown archive format, " << endianness;
+        return ss.str();
+    }
+
+    /* walk the headers without throwing; 0 means this isn't our format,
+     * anything else grows with the number of headers that checked out */
+    static size_t probe(const ::input& in)
+    {
+        std::remove_const_t<decltype(magic)> m {};
+        header_type hdr {};
+        size_t pos = sizeof(magic), end = in.size(), count = 1;
+
+        if (!peek(in, 0, m) || (swap_endian<endianness>(m) != magic))
+            return 0;
+        while (pos + sizeof(header_type) <= end) {
+            if (!peek(in, pos, hdr) || (hdr.ar_name[0] == 0))
+                return 0;
+            size_t size = swap_endian<endianness>(hdr.ar_size);
+            pos += sizeof(header_type);
+            if (size > end - pos)
+                return 0;
+            pos += align(size, alignment);
+            ++count;
+        }
+        return (pos == end) ? count : 0;
+    }
+
+    /* fill in an entry from raw header bytes (which must be big enough, and
+     * outlive the entry, since that's where its name is) */
+    static void decode_header(std::span<const std::byte> data, entry& ent)
+    {
+        header_type hdr;
+        using name_field = decltype(hdr.ar_name);
+        memcpy((void*)&hdr, data.data(), sizeof(hdr));
+        decode_header(hdr, ent);
+        ent.name = parse_field(*(const name_field*)(data.data()
+                                   + offsetof(header_type, ar_name)));
+    }
+
+    /* nothing to fix up once the content is known */
+    static void resolve_name(entry&, std::string&)
+    {}
+
+    /* whether a member's content follows its header */
+    static bool stored(const entry&)
+    {
+        return true;
+    }
+
+protected:
+    void read_header(entry& ent, size_t pos)
+    {
+        // prepopulate fields we already know about
+        ent.input = input.get();
+        ent.header_offset = pos;
+        ent.content_offset = ent.header_offset + sizeof(header_type);
+        // decode the header where it is in the input
+        auto data = input->view(pos, sizeof(header_type));
+        if (data.size() != sizeof(header_type))
+            throw std::exception {};
+        decode_header(data, ent);
+    }
+
+    /* everything but the name, which stays where it was */
+    static void decode_header(const header_type& hdr, entry& ent)
+    {
+        // content_size is required
+        ent.content_size = swap_endian<endianness>(hdr.ar_size);
+        // any others may or may not appear
+        if constexpr (has_date<header_type>)
+            ent.date = swap_endian<endianness>(hdr.ar_date);
+        if constexpr (has_uid<header_type>)
+            ent.uid = swap_endian<endianness>(hdr.ar_uid);
+        if constexpr (has_gid<header_type>)
+            ent.gid = swap_endian<endianness>(hdr.ar_gid);
+        if constexpr (has_mode<header_type>)
+            ent.mode = swap_endian<endianness>(hdr.ar_mode);
+    }
+
+    void read_headers()
+    {
+        entry ent {};
+        size_t pos = sizeof(magic);
+        size_t end = input->size();
+        while (pos + sizeof(header_type) <= end) {
+            read_header(ent, pos);
+            if (!ent.name.size() || (ent.name.at(0) == 0))
+                throw std::exception {};
+            add_header(ent);
+            pos = ent.content_offset + align(ent.content_size, alignment);
+        }
+        if (pos != end)
+            throw std::exception {};
+    }
+
+public:
+    static void write_magic(output& os)
+    {
+        auto m = swap_endian<endian::native, Endian>(magic);
+        os.write((char*)&m, sizeof(m));
+    }
+
+    static void write_entry(const entry& ent, output& stream)
+    {
+        header_type hdr;
+        // clear out header so we don't have any "bonus" data
+        memset((char*)&hdr, 0, sizeof(hdr));
+        // if our name is too large, then just truncate with a dumb hash
+        auto name = ent.member_name();
+        if (name.size() > sizeof(hdr.ar_name)) {
+            unsigned short sum = 0;
+            for (size_t i = 0; i < name.size(); ++i)
+                sum += name.at(i);
+            sum += name.size();
+            format_field(hdr.ar_name, "%.*s%04hx", (int)sizeof(hdr.ar_name)-4,
+                         name.data(), sum);
+        } else {
+            format_field(hdr.ar_name, "%.*s", (int)name.size(), name.data());
+        }
+        // the size has to fit, or the archive is useless
+        hdr.ar_size = size_field(ent, hdr.ar_size);
+        // now store any of the other fields we have
+        if constexpr (has_date<header_type>)
+            hdr.ar_date = swap_endian_to<endianness>(ent.date, hdr.ar_date);
+        if constexpr (has_uid<header_type>)
+            hdr.ar_uid = swap_endian_to<endianness>(ent.uid, hdr.ar_uid);
+        if constexpr (has_gid<header_type>)
+            hdr.ar_gid = swap_endian_to<endianness>(ent.gid, hdr.ar_gid);
+        if constexpr (has_mode<header_type>)
+            hdr.ar_mode = swap_endian_to<endianness>(ent.mode, hdr.ar_mode);
+        // and write the header and content out to the stream
+        stream.write((char*)&hdr, sizeof(hdr));
+        ent.copy_content_to(stream, alignment);
+    }
+
+    static void write(output& os, shared_archive archive,
+                      const write_options& options)
+    {
+        size_t i = 0;
+        write_magic(os);
+        for (auto entry : archive->get_members()) {
+            if (!options.duplicate(i++))
+                write_entry(entry, os);
+        }
+    }
+
+protected:
+    /* a member's size as it goes in the header, if the header can hold it;
+     * everything else is just metadata these formats were never able to
+     * hold in full, so it's still truncated */
+    template <std::integral O>
+    static O size_field(const entry& ent, const O& field)
+    {
+        if (ent.content_size > (uint64_t)std::numeric_limits<O>::max())
+            throw std::system_error { EFBIG, std::generic_category(),
+                                      std::string { ent.member_name() } };
+        return swap_endian_to<endianness>(ent.content_size, field);
+    }
+};
+
+template <template<endian> class A>
+std::shared_ptr<::Archive> detect(shared_input is)
+{
+    auto l = A<endian::little>::probe(*is);
+    auto b = A<endian::big>::probe(*is);
+    auto m = A<endian::mixed>::probe(*is);
+
+    if (l && (l >= b) && (l >= m))
+        return std::make_shared<A<endian::little>>(is);
+    if (b && (b >= m))
+        return std::make_shared<A<endian::big>>(is);
+    if (m)
+        return std::make_shared<A<endian::mixed>>(is);
+    throw std::system_error { EINVAL, std::generic_category(),
+                              "unrecognized archive format" };
+}
+
+namespace ancient {
+
+constexpr size_t alignment = 2;
+
+template <endian Endian>
+class Archive
+    : public common::Archive<magic, ar_hdr, alignment, Endian>
+{
+public:
+    Archive(shared_input is)
+        : common::Archive<magic, ar_hdr, alignment, Endian> { is }
+    {}
+
+    virtual std::string description() const
+    {
+        std::stringstream ss;
+        ss << "ancient UNIX 16-bit archive format, " << this->endianness;
+        return ss.str();
+    }
+};
+
+std::shared_ptr<::Archive> detect(shared_input is);
+
+} // ::ancient
+
+namespace old {
+
+constexpr size_t alignment = 2;
+
+template <endian Endian>
+class Archive
+    : public common::Archive<magic, ar_hdr, alignment, Endian>
+{
+public:
+    Archive(shared_input is)
+        : common::Archive<magic, ar_hdr, alignment, Endian> { is }
+    {}
+
+    virtual std::string description() const
+    {
+        std::stringstream ss;
+        ss << "old UNIX 16-bit archive format, " << this->endianness;
+        return ss.str();
+    }
+};
+
+
+std::shared_ptr<::Archive> detect(shared_input is);
+
+} // ::old
+
+namespace current {
+
+constexpr auto alignment = 2;
+
+class Archive
+    : public ::Archive
+{
+public:
+    using header_type = ar_hdr;
+    static constexpr auto alignment = current::alignment;
+
+    Archive(shared_input input)
+        : ::Archive { input }
+    {
+        if (!check_magic(magic))
+            throw std::exception {};
+        read_headers();
+    }
+
+protected:
+    /* for variants that check their own magic and walk their own members */
+    struct unparsed {};
+
+    Archive(shared_input input, unparsed)
+        : ::Archive { input }
+    {}
+
+public:
+    virtual std::string description() const
+    {
+        return "current format archive";
+    }
+
+    static size_t probe(const ::input& in)
+    {
+        std::vector<scan::member> members;
+
+        auto head = in.view(0, magic.size());
+        if (std::string_view { (const char*)head.data(), head.size() } != magic)
+            return 0;
+        if (!scan::members(in.data(), magic.size(), alignment, members))
+            return 0;
+        if (members.size()) {
+            auto& last = members.back();
+            if (last.size > in.size() - last.header_offset - sizeof(ar_hdr))
+                return 0;
+        }
+        return members.size() + 1;
+    }
+
+    static bool stored(const entry&)
+    {
+        return true;
+    }
+
+    /* fill in an entry from raw header bytes (which must be big enough, and
+     * outlive the entry, since that's where its name is) */
+    static void decode_header(std::span<const std::byte> data, entry& ent)
+    {
+        // nothing but characters, so it can be read in place
+        auto& hdr = *(const ar_hdr*)data.data();
+        // make sure the file header magic matches
+        if (parse_field(hdr.ar_fmag) != fmag)
+            throw std::exception {};
+        parse_field_into<' '>(&ent.content_size, hdr.ar_size);
+        decode_fields(hdr, ent);
+    }
+
+    /*
+     * Once the entry's input and content boundaries are set up, turn the name
+     * from the header into the real one. `names` carries the GNU name table
+     * from the member that defines it to the ones that follow; names found
+     * in there, or in the content, are views of it.
+     *
+     *   #1/<len>   BSD: the name is the first <len> bytes of the content
+     *   /<offset>  GNU: the name is in the table, terminated by "/\n"
+     *   <name>/    GNU: a short name, with a terminator so it can have spaces
+     */
+    static void resolve_name(entry& ent, std::string& names)
+    {
+        if (ent.name == gnu_names) {
+            auto table = ent.content();
+            names.assign((const char*)table.data(), table.size());
+        } else if ((ent.name.size() > 1) && (ent.name[0] == '/')
+                && isdigit((unsigned char)ent.name[1])) {
+            auto offstr = ent.name.substr(1);
+            size_t offset;
+            auto [p, ec] = std::from_chars(offstr.data(),
+                                           offstr.data() + offstr.size(),
+                                           offset);
+            if ((ec != std::errc {}) || (p != offstr.data() + offstr.size())
+                    || (offset >= names.size()))
+                throw std::exception {};
+            auto end = names.find('\n', offset);
+            auto name = std::string_view { names }.substr(offset, end - offset);
+            if (name.ends_with('/'))
+                name.remove_suffix(1);
+            ent.name = name;
+        } else if (!ent.name.empty() && (ent.name[0] != '/')
+                && ent.name.ends_with('/')) {
+            ent.name.remove_suffix(1);
+        } else if (ent.name.starts_with(extended)) {
+            auto lenstr = ent.name.substr(extended.size());
+            size_t namelen;
+            auto [p, ec] = std::from_chars(lenstr.data(),
+                                           lenstr.data() + lenstr.size(),
+                                           namelen);
+            if ((ec != std::errc {}) || (p != lenstr.data() + lenstr.size()))
+                throw std::exception {};
+            auto ext = ent.input->view(ent.content_offset, namelen);
+            if ((ext.size() != namelen) || (namelen > ent.content_size))
+                throw std::exception {};
+            auto buf = (const char*)ext.data();
+            ent.name = { buf, strnlen(buf, namelen) };
+            ent.content_size -= namelen;
+            ent.content_offset += namelen;
+        }
+    }
+
+protected:
+    /* fill in an entry for the header at `pos`, whose magic and size have
+     * already been checked by the batch scanner */
+    void read_header(entry& ent, size_t pos, size_t size, std::string& names)
+    {
+        // prepopulate fields we already know about
+        ent.input = input.get();
+        ent.header_offset = pos;
+        ent.content_offset = ent.header_offset + sizeof(ar_hdr);
+        ent.content_size = size;
+        // decode the header where it is in the input
+        auto data = input->view(pos, sizeof(ar_hdr));
+        if (data.size() != sizeof(ar_hdr))
+            throw std::exception {};
+        decode_fields(*(const ar_hdr*)data.data(), ent);
+        resolve_name(ent, names);
+    }
+
+    /* everything but the size, with the name as it appears in the header */
+    static void decode_fields(const ar_hdr& hdr, entry& ent)
+    {
+        // GNU names may have spaces in them, so only trailing ones are padding
+        auto name = parse_field(hdr.ar_name);
+        ent.name = name.substr(0, name.find_last_not_of(' ') + 1);
+        parse_optional_field_into(&ent.date, hdr.ar_date);
+        parse_optional_field_into(&ent.uid, hdr.ar_uid);
+        parse_optional_field_into(&ent.gid, hdr.ar_gid);
+        parse_optional_field_into<8>(&ent.mode, hdr.ar_mode);
+    }
+
+    /* GNU leaves these blank on its own special members, so a blank field
+     * just means zero; anything else that doesn't parse is an error */
+    template <size_t Base = 10, std::integral T, size_t N>
+    static void parse_optional_field_into(T* field, const char (&buf)[N])
+    {
+        auto ec = try_parse_field_into<' ', Base>(field, buf);
+        if (ec == std::errc {})
+            return;
+        if (std::string_view { buf, N }.find_first_not_of(' ')
+                == std::string_view::npos) {
+            *field = 0;
+            return;
+        }
+        throw std::system_error { std::make_error_code(ec),
+                                  "malformed header field" };
+    }
+
+    void read_headers()
+    {
+        entry ent {};
+        std::string names;
+        std::vector<scan::member> members;
+        // find every member in one go, then fill in the details
+        if (!scan::members(input->data(), magic.size(), alignment, members))
+            throw std::exception {};
+        for (auto& m : members) {
+            read_header(ent, m.header_offset, m.size, names);
+            if (!ent.name.size() || (ent.name.at(0) == 0))
+                throw std::exception {};
+            add_header(ent);
+        }
+    }
+
+    /* the most the ten decimal digits of `ar_size` can hold */
+    static constexpr uint64_t max_size = 9'999'999'999;
+    static_assert(sizeof(ar_hdr::ar_size) == 10);
+
+    /* header bytes with `field` as the name field, exactly as given */
+    static std::string make_raw_header(std::string_view field, size_t size,
+                                       unsigned long date = 0,
+                                       unsigned uid = 0, unsigned gid = 0,
+                                       unsigned mode = 0)
+    {
+        ar_hdr hdr;
+
+        if (size > max_size)
+            throw std::system_error { EFBIG, std::generic_category(),
+                                      std::string { field } };
+        memset(&hdr, ' ', sizeof(hdr));
+        format_field(hdr.ar_name, "%.*s", (int)field.size(), field.data());
+        format_field(hdr.ar_date, "%lu", date);
+        format_field(hdr.ar_uid, "%u", uid);
+        format_field(hdr.ar_gid, "%u", gid);
+        format_field(hdr.ar_mode, "%o", mode);
+        format_field(hdr.ar_size, "%lu", size);
+        format_field(hdr.ar_fmag, "%s", fmag.data());
+
+        return std::string { (const char*)&hdr, sizeof(hdr) };
+    }
+
+    /* header bytes for a member, including any BSD-style extended name */
+    static std::string make_header(std::string_view name, size_t size,
+                                   unsigned long date = 0, unsigned uid = 0,
+                                   unsigned gid = 0, unsigned mode = 0)
+    {
+        constexpr auto npos = std::string::npos;
+
+        if ((name.find(' ') == npos) && (name.size() <= sizeof(ar_hdr::ar_name)))
+            return make_raw_header(name, size, date, uid, gid, mode);
+
+        /* pad the name the way cctools does, so member data following the
+         * header and name lands on an 8-byte boundary */
+        auto len = align(name.size(), 4);
+        if ((sizeof(ar_hdr) + len) % 8)
+            len += 4;
+        std::string extra(len, '\0');
+        memcpy(extra.data(), name.data(), name.size());
+        auto field = std::string { extended } + std::to_string(len);
+        return make_raw_header(field, size + len, date, uid, gid, mode)
+             + extra;
+    }
+
+    static std::string make_header(const entry& ent)
+    {
+        return make_header(ent.member_name(), ent.content_size, ent.date,
+                           ent.uid, ent.gid, ent.mode);
+    }
+
+    /*
+     * Collects the GNU "//" table while handing out name fields. Short names
+     * go straight in the header with a '/' terminator; anything longer, or
+     * with a '/' of its own, is stored once in the table and referred to by
+     * its offset there, however many members share it.
+     */
+    class name_table
+    {
+        std::string _table;
+        std::map<std::string_view, size_t> _offsets;
+        bool _all;
+
+    public:
+        /* `all` puts every name in the table, as thin archives do */
+        explicit name_table(bool all = false)
+            : _all { all }
+        {}
+
+        std::string field(std::string_view name)
+        {
+            if (!_all && (name.size() < sizeof(ar_hdr::ar_name))
+                    && (name.find('/') == std::string_view::npos))
+                return std::string { name } + "/";
+            auto [it, added] = _offsets.emplace(name, _table.size());
+            if (added)
+                _table.append(name).append("/\n");
+            return "/" + std::to_string(it->second);
+        }
+
+        /* the table member's content, padded with a newline like GNU ar */
+        std::string contents() const
+        {
+            auto out = _table;
+            if (out.size() % alignment)
+                out.push_back('\n');
+            return out;
+        }
+    };
+
+public:
+    static void write_magic(output& os)
+    {
+        os.write(magic.data(), magic.size());
+    }
+
+    static void write_entry(const entry& ent, output& stream)
+    {
+        stream.write(make_header(ent));
+        ent.copy_content_to(stream, alignment);
+    }
+
+protected:
+
+    using symbol = std::pair<std::string_view, size_t>;
+
+    /* name of the symbol index member, which also says how wide it is */
+    static std::string_view index_name(symbol_index kind, bool wide)
+    {
+        if (kind == symbol_index::gnu)
+            return wide ? "/SYM64/" : "/";
+        return wide ? "__.SYMDEF_64 SORTED" : "__.SYMDEF SORTED";
+    }
+
+    /*
+     * Build the contents of a symbol index member mapping each symbol to the
+     * offset of the header of the member defining it. Its size only depends
+     * on the symbols, so callers can lay out the archive with placeholder
+     * offsets first and then build it again for real.
+     *
+     * A `wide` index uses 64-bit words throughout (GNU "/SYM64/", Darwin's
+     * "__.SYMDEF_64"), for when members start beyond 4 GiB.
+     */
+    static std::string make_index(symbol_index kind, endian order, bool wide,
+                                  const std::vector<symbol>& symbols,
+                                  const std::vector<size_t>& offsets)
+    {
+        std::string out;
+        auto put = [&]<class U>(U value, endian e) {
+            switch (e)
+            {
+            case endian::big:
+                value = swap_endian<endian::native, endian::big>(value);
+                break;
+            case endian::little:
+                value = swap_endian<endian::native, endian::little>(value);
+                break;
+            case endian::mixed:
+                value = swap_endian<endian::native, endian::mixed>(value);
+                break;
+            }
+            out.append((const char*)&value, sizeof(value));
+        };
+        auto put_word = [&](uint64_t value, endian e) {
+            if (wide)
+                put((uint64_t)value, e);
+            else
+                put((uint32_t)value, e);
+        };
+        // a whole table of big-endian words, converted in one go
+        auto put_table = [&]<class U>(U count) {
+            std::vector<U> words { count };
+            for (auto& [name, member] : symbols)
+                words.push_back(offsets[member]);
+            swap_endian_span<endian::native, endian::big>(std::span { words });
+            out.append((const char*)words.data(), words.size() * sizeof(U));
+        };
+        size_t word = wide ? 8 : 4;
+
+        switch (kind)
+        {
+        // GNU/SysV: big-endian count, offsets, then the names in order
+        case symbol_index::gnu:
+            if (wide)
+                put_table((uint64_t)symbols.size());
+            else
+                put_table((uint32_t)symbols.size());
+            for (auto& [name, member] : symbols)
+                out.append(name).push_back('\0');
+            break;
+
+        // BSD: ranlib structures in target byte order, sorted by name
+        case symbol_index::bsd:
+            {
+                auto sorted = symbols;
+                std::stable_sort(sorted.begin(), sorted.end(),
+                    [](auto& a, auto& b) { return a.first < b.first; });
+                std::string strtab;
+                put_word(sorted.size() * word * 2, order);
+                for (auto& [name, member] : sorted) {
+                    put_word(strtab.size(), order);
+                    put_word(offsets[member], order);
+                    strtab.append(name).push_back('\0');
+                }
+                strtab.resize(align(strtab.size(), word), '\0');
+                put_word(strtab.size(), order);
+                out.append(strtab);
+            }
+            break;
+
+        case symbol_index::none:
+            break;
+        }
+        return out;
+    }
+
+public:
+    static void write(output& os, shared_archive archive,
+                      const write_options& options)
+    {
+        std::vector<entry> members;
+        size_t i = 0;
+        for (auto e : archive->get_members()) {
+            if (!options.duplicate(i++))
+                members.push_back(e);
+        }
+        write_members(os, members, options, false);
+    }
+
+protected:
+    /*
+     * Lay out and write a whole archive. A thin one gets its own magic, keeps
+     * every name in the table, and has nothing but a header for each member.
+     */
+    static void write_members(output& os, const std::vector<entry>& members,
+                              const write_options& options, bool thin)
+    {
+        std::vector<std::string> headers;
+        name_table gnu_table { thin };
+        for (auto& e : members) {
+            auto name = thin ? e.name : e.member_name();
+            if (thin || (options.names == long_names::gnu))
+                headers.push_back(make_raw_header(gnu_table.field(name),
+                                                  e.content_size, e.date,
+                                                  e.uid, e.gid, e.mode));
+            else
+                headers.push_back(make_header(e));
+        }
+        auto table = gnu_table.contents();
+
+        // collect the symbols every (ELF) member defines
+        std::vector<symbol> symbols;
+        std::vector<std::string_view> names;
+        std::deque<std::string> copies;
+        std::optional<endian> order;
+        if (options.index != symbol_index::none) {
+            for (size_t i = 0; i < members.size(); ++i) {
+                /* external files are only open while we look at them, so
+                 * their symbol names have to be copied out */
+                shared_input source;
+                std::span<const std::byte> data;
+                if (members[i].external.empty()) {
+                    data = members[i].content();
+                } else {
+                    source = members[i].source();
+                    data = source->view(0, members[i].content_size);
+                }
+                names.clear();
+                auto e = elf::defined_symbols(data, names);
+                if (e && !order)
+                    order = e;
+                for (auto name : names) {
+                    if (source)
+                        name = copies.emplace_back(name);
+                    symbols.emplace_back(name, i);
+                }
+            }
+        }
+
+        // lay everything out to find where each member will land...
+        auto archive_magic = thin ? thin_magic : magic;
+        auto byte_order = order.value_or(endian::native);
+        std::vector<size_t> offsets(members.size());
+        std::string index;
+        bool wide = false;
+        size_t pos;
+        auto lay_out = [&] {
+            pos = archive_magic.size();
+            if (!symbols.empty()) {
+                index = make_index(options.index, byte_order, wide, symbols,
+                                   offsets);
+                pos += make_header(index_name(options.index, wide),
+                                   index.size()).size()
+                     + align(index.size(), alignment);
+            }
+            if (!table.empty())
+                pos += sizeof(ar_hdr) + table.size();
+            for (size_t i = 0; i < members.size(); ++i) {
+                offsets[i] = pos;
+                pos += thin ? headers[i].size()
+                            : align(headers[i].size()
+                                    + members[i].content_size, alignment);
+            }
+        };
+        lay_out();
+        // ...and if any of them are out of reach, use a 64-bit index instead
+        if (!symbols.empty() && !offsets.empty()
+                && (offsets.back() > std::numeric_limits<uint32_t>::max())) {
+            wide = true;
+            lay_out();
+        }
+        // that also tells us how big the whole thing is going to be
+        os.reserve(pos);
+
+        os.write(archive_magic);
+        if (!symbols.empty()) {
+            // now the index can be written out for real
+            index = make_index(options.index, byte_order, wide, symbols,
+                               offsets);
+            os.write(make_header(index_name(options.index, wide),
+                                 index.size()));
+            os.write(index);
+            os.pad(index.size() % alignment);
+        }
+        if (!table.empty()) {
+            os.write(make_raw_header(gnu_names, table.size()));
+            os.write(table);
+        }
+        for (size_t i = 0; i < members.size(); ++i) {
+            os.write(headers[i]);
+            if (!thin)
+                members[i].copy_content_to(os, alignment);
+        }
+    }
+};
+
+std::shared_ptr<::Archive> detect(shared_input is);
+
+namespace thin {
+
+/*
+ * GNU thin archive: current format headers, but only the symbol index and
+ * name table are really stored. Every other member is just a header whose
+ * name is the path (relative to the archive) of the file holding it, so
+ * collecting objects into a library doesn't copy any of them.
+ */
+class Archive
+    : public current::Archive
+{
+public:
+    Archive(shared_input input)
+        : current::Archive { input, unparsed {} }
+    {
+        if (!check_magic(thin_magic))
+            throw std::exception {};
+        read_headers();
+    }
+
+    virtual std::string description() const
+    {
+        return "GNU thin archive";
+    }
+
+    /* going by the name as it appears in the header */
+    static bool stored(const entry& ent)
+    {
+        return format_files.contains(ent.name);
+    }
+
+    static size_t probe(const ::input& in)
+    {
+        entry ent {};
+        size_t pos = thin_magic.size(), end = in.size(), count = 1;
+
+        auto head = in.view(0, thin_magic.size());
+        if (std::string_view { (const char*)head.data(), head.size() }
+                != thin_magic)
+            return 0;
+        while (pos + sizeof(ar_hdr) <= end) {
+            try {
+                decode_header(in.view(pos, sizeof(ar_hdr)), ent);
+            } catch (std::exception&) {
+                return 0;
+            }
+            pos += sizeof(ar_hdr);
+            if (stored(ent)) {
+                if (ent.content_size > end - pos)
+                    return 0;
+                pos += align(ent.content_size, alignment);
+            }
+            ++count;
+        }
+        return count;
+    }
+
+    /* resolve the name, and for real members, that's where the content is */
+    static void resolve_name(entry& ent, std::string& names)
+    {
+        // there's no content to find a BSD-style name in
+        if (ent.name.starts_with(extended))
+            throw std::exception {};
+        bool member = !stored(ent);
+        current::Archive::resolve_name(ent, names);
+        if (member) {
+            ent.external = ent.name;
+            ent.content_offset = 0;
+        }
+    }
+
+    static void write_magic(output& os)
+    {
+        os.write(thin_magic);
+    }
+
+    /*
+     * Members that are already external files are referred to where they
+     * are. Anything else gets extracted (once) next to the new archive, and
+     * referred to there. Duplicates keep their own entry, but share the file
+     * of the first member with the same content.
+     *
+     * Every name is checked before any file is written, files that are
+     * already there are never replaced, and if anything goes wrong, the
+     * files written so far are removed again.
+     */
+    static void write(output& os, shared_archive archive,
+                      const write_options& options)
+    {
+        std::vector<entry> linked;
+        // members to extract, as they are in the archive
+        std::vector<std::pair<size_t, entry>> stored;
+        std::set<fs::path> extracted;
+        // where the new names and paths live, since entries only view them
+        std::deque<std::string> paths;
+        for (auto e : archive->get_members()) {
+            auto i = linked.size();
+            auto& l = linked.emplace_back(e);
+            if (options.duplicate(i)) {
+                l.external = linked[options.originals[i]].external;
+                l.input = nullptr;
+                l.content_offset = 0;
+            } else if (e.external.empty()) {
+                auto path = fs::path { e.name }.filename();
+                if (path.empty() || (path == ".") || (path == ".."))
+                    throw std::system_error { EINVAL, std::generic_category(),
+                                              std::string { e.name } };
+                // two members can't both live in the same file
+                if (!extracted.insert(path).second)
+                    throw std::system_error { EEXIST, std::generic_category(),
+                                              std::string { e.name } };
+                l.external = paths.emplace_back(options.base / path);
+                stored.emplace_back(i, e);
+            }
+            l.name = paths.emplace_back(
+                fs::proximate(fs::path { l.external }, options.base));
+        }
+
+        std::vector<fs::path> created;
+        try {
+            for (auto& [i, e] : stored) {
+                auto& l = linked[i];
+                fs::path path { l.external };
+                int fd = ::open(path.c_str(),
+                                O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                                (mode_t)((e.mode & 0777) ?: 0644));
+                if (fd < 0)
+                    throw std::system_error { errno, std::generic_category(),
+                                              path.string() };
+                created.push_back(path);
+                try {
+                    output o { fd };
+                    o.reserve(e.content_size);
+                    e.copy_content_to(o);
+                    o.flush();
+                } catch (...) {
+                    ::close(fd);
+                    throw;
+                }
+                ::close(fd);
+                l.input = nullptr;
+                l.content_offset = 0;
+            }
+            write_members(os, linked, options, true);
+        } catch (...) {
+            for (auto& path : created) {
+                std::error_code ec;
+                fs::remove(path, ec);
+            }
+            throw;
+        }
+    }
+
+protected:
+    void read_headers()
+    {
+        entry ent {};
+        std::string names;
+        fs::path external;
+        size_t pos = thin_magic.size();
+        size_t end = input->size();
+        while (pos + sizeof(ar_hdr) <= end) {
+            decode_header(input->view(pos, sizeof(ar_hdr)), ent);
+            ent.input = input.get();
+            ent.header_offset = pos;
+            ent.content_offset = pos + sizeof(ar_hdr);
+            ent.external = {};
+            pos = ent.content_offset;
+            if (stored(ent))
+                pos += align(ent.content_size, alignment);
+            resolve_name(ent, names);
+            if (!ent.name.size() || (ent.name.at(0) == 0))
+                throw std::exception {};
+            // member paths are relative to the archive, not to us
+            if (!ent.external.empty()
+                    && fs::path { ent.external }.is_relative()) {
+                external = input->path().parent_path() / ent.external;
+                ent.external = external.native();
+            }
+            add_header(ent);
+        }
+    }
+};
+
+std::shared_ptr<::Archive> detect(shared_input is);
+
+} // ::thin
+
+
+} // ::current
+
+} // ::common
+
+namespace bsd {
+
+namespace old3 {
+
+constexpr size_t alignment = 2;
+
+template <endian Endian>
+class Archive
+    : public common::Archive<magic, ar_hdr, alignment, Endian>
+{
+public:
+    Archive(shared_input is)
+        : common::Archive<magic, ar_hdr, alignment, Endian> { is }
+    {}
+
+    virtual std::string description() const
+    {
+        std::stringstream ss;
+        ss << "old BSD 32-bit archive format, " << this->endianness;
+        return ss.str();
+    }
+};
+
+std::shared_ptr<::Archive> detect(shared_input is);
+
+} // ::old3
+
+} // ::bsd
+
+
+/*
+ * Loose files posing as an archive, so that creating one is just converting
+ * this into the target format. Files are stat'ed and opened (mapped) in
+ * parallel; writers then go through them in order like any other members.
+ */
+class file_list
+    : public Archive
+{
+    // what the members' content comes from, which has to stay around
+    std::vector<shared_input> _files;
+    shared_archive _base;
+
+public:
+    /*
+     * `linked` members keep referring to their files (for thin archives),
+     * and `deterministic` ones drop dates, owners and permissions so that
+     * the same inputs always make the same archive.
+     */
+    file_list(const std::vector<std::string>& paths, size_t threads,
+              bool linked = false, bool deterministic = false)
+        : Archive { nullptr }
+    {
+        std::vector<std::string> names;
+        for (auto& ent : open_all(paths, threads, linked, deterministic,
+                                  names))
+            add_header(ent);
+    }
+
+    /*
+     * The members of `base` followed by the files, or if `replace` is set,
+     * with each file taking the place of the member it has the same name as
+     * (if there is one), just like ar(1).
+     */
+    file_list(shared_archive base, const std::vector<std::string>& paths,
+              size_t threads, bool replace, bool linked = false,
+              bool deterministic = false)
+        : Archive { nullptr }
+        , _base { base }
+    {
+        std::vector<entry> members;
+        std::vector<std::string> names;
+        for (auto e : base->get_members())
+            members.push_back(e);
+        for (auto& ent : open_all(paths, threads, linked, deterministic,
+                                  names)) {
+            // thin archives name members by path, which can be spelled out
+            // any number of ways
+            auto same = [&](const entry& e) {
+                std::error_code ec;
+                return linked ? fs::equivalent(fs::path { e.external },
+                                               fs::path { ent.external }, ec)
+                              : (e.name == ent.name);
+            };
+            auto it = replace ? std::ranges::find_if(members, same)
+                              : members.end();
+            if (it != members.end())
+                *it = ent;
+            else
+                members.push_back(ent);
+        }
+        for (auto& e : members)
+            add_header(e);
+    }
+
+    virtual std::string description() const
+    {
+        return "list of files";
+    }
+
+private:
+    /* the entries name themselves after `names`, which gets one per path */
+    std::vector<entry> open_all(const std::vector<std::string>& paths,
+                                size_t threads, bool linked,
+                                bool deterministic,
+                                std::vector<std::string>& names)
+    {
+        std::vector<entry> found(paths.size());
+        std::vector<std::exception_ptr> errors(paths.size());
+        auto first = _files.size();
+        _files.resize(first + paths.size());
+        names.resize(paths.size());
+        auto open = [&](size_t i) {
+            try {
+                found[i] = make_entry(paths[i], linked, deterministic,
+                                      _files[first + i], names[i]);
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        };
+        if (threads == 1) {
+            for (size_t i = 0; i < paths.size(); ++i)
+                open(i);
+        } else {
+            thread_pool pool { threads };
+            for (size_t i = 0; i < paths.size(); ++i)
+                pool.submit([&open, i] { open(i); });
+            pool.wait();
+        }
+        for (auto& e : errors) {
+            if (e)
+                std::rethrow_exception(e);
+        }
+        return found;
+    }
+
+    static entry make_entry(const fs::path& path, bool linked,
+                            bool deterministic, shared_input& file,
+                            std::string& name)
+    {
+        struct stat st;
+        if (stat(path.c_str(), &st) < 0)
+            throw std::system_error { errno, std::generic_category(),
+                                      path.string() };
+        if (!S_ISREG(st.st_mode))
+            throw std::system_error { EINVAL, std::generic_category(),
+                                      path.string() };
+
+        entry ent {};
+        file = open_input(path);
+        name = linked ? path.string() : path.filename().string();
+        ent.input = file.get();
+        ent.content_offset = 0;
+        ent.content_size = file->size();
+        ent.name = name;
+        if (linked)
+            ent.external = name;
+        if (deterministic) {
+            ent.mode = 0644;
+        } else {
+            ent.date = st.st_mtime;
+            ent.uid = st.st_uid;
+            ent.gid = st.st_gid;
+            ent.mode = st.st_mode;
+        }
+        return ent;
+    }
+};
+
+
+using detector = std::function<shared_archive(shared_input)>;
+using constructor = std::function<void(output&, shared_archive,
+                                       const write_options&)>;
+using starter = std::function<void(output&)>;
+using appender = std::function<void(const entry&, output&)>;
+
+/*
+ * Everything we know how to do with a format: find it in an input, write a
+ * whole archive in it, or (for forward-only outputs) write the magic and then
+ * append members one at a time.
+ */
+struct format
+{
+    detector detect;
+    constructor construct;
+    starter start;
+    appender append;
+};
+
+template <class A>
+format make_format(detector detect)
+{
+    return { detect, A::write, A::write_magic, A::write_entry };
+}
+
+extern std::map<std::string_view, format> formats;
+
+/*
+ * Single-pass format identification: look at the leading magic once, narrow
+ * the registry down to the formats that could possibly have produced it, and
+ * only then walk headers for those candidates. Nothing in here throws to
+ * reject a format, so probing lots of non-archives costs little more than
+ * reading their first few bytes.
+ */
+struct detection
+{
+    std::string_view format;
+    size_t score = 0;
+    shared_archive archive;
+
+    explicit operator bool() const
+    {
+        return (bool)archive;
+    }
+};
+
+template <endian Endian, std::integral I>
+std::string magic_bytes(I magic)
+{
+    auto value = swap_endian<endian::native, Endian>(magic);
+    return std::string { (const char*)&value, sizeof(value) };
+}
+
+template <class A>
+shared_archive make_archive(shared_input is)
+{
+    return std::make_shared<A>(is);
+}
+
+struct probe_entry
+{
+    std::string magic;
+    std::string_view format;
+    size_t (*probe)(const input&);
+    shared_archive (*make)(shared_input);
+    // what a forward-only reader needs to walk members
+    size_t header_size;
+    size_t alignment;
+    void (*decode)(std::span<const std::byte>, entry&);
+    void (*resolve)(entry&, std::string&);
+    bool (*stored)(const entry&);
+};
+
+template <class A>
+probe_entry make_probe(std::string magic, std::string_view format)
+{
+    return { std::move(magic), format, A::probe, make_archive<A>,
+             sizeof(typename A::header_type), A::alignment,
+             A::decode_header, A::resolve_name, A::stored };
+}
+
+/* the formats that can be told apart by their magic and headers; any that
+ * share a prefix with a shorter one come first */
+extern const std::vector<probe_entry> probes;
+
+/* the format that fits best, or nothing (which is false) if none does */
+detection identify_format(shared_input is);
+
+/* the same, but throwing std::system_error if nothing fits */
+shared_archive detect_any_format(shared_input is);
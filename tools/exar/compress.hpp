@@ -0,0 +1,369 @@
+/* This file is part of Polyglot.
+
+  Copyright (C) 2024, Battelle Energy Alliance, LLC ALL RIGHTS RESERVED
+
+  Polyglot is free software; you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation; either version 3, or (at your option) any later version.
+
+  Polyglot is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  this software; if not see <http://www.gnu.org/licenses/>. */
+
+#include <climits>
+#include <cstddef>
+#include <cstring>
+#include <istream>
+#include <memory>
+#include <span>
+#include <streambuf>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#if __has_include(<zlib.h>)
+#include <zlib.h>
+#define EXAR_GZIP 1
+#endif
+#if __has_include(<zstd.h>)
+#include <zstd.h>
+#define EXAR_ZSTD 1
+#endif
+
+/*
+ * Compressed wrappers around whole archives. Either codec is only available if
+ * its library was around at build time (the Makefile links whichever headers
+ * it finds); asking for one that isn't fails with ENOTSUP.
+ */
+
+enum class compression
+{
+    none,
+    gzip,
+    zstd,
+};
+
+/* tell a compressed stream apart from anything else by its first bytes */
+inline compression detect_compression(std::span<const std::byte> head)
+{
+    static constexpr unsigned char gzip_magic[] = { 0x1f, 0x8b };
+    static constexpr unsigned char zstd_magic[] = { 0x28, 0xb5, 0x2f, 0xfd };
+
+    auto starts_with = [&](auto& magic) {
+        return (head.size() >= sizeof(magic))
+            && !memcmp(head.data(), magic, sizeof(magic));
+    };
+    if (starts_with(zstd_magic))
+        return compression::zstd;
+    if (starts_with(gzip_magic))
+        return compression::gzip;
+    return compression::none;
+}
+
+/*
+ * Incremental compressor or decompressor: each run() consumes what it can of
+ * `in` and fills as much of `out` as it can. `done` means a decoder is at the
+ * end of a stream (more may follow, since concatenated streams are valid for
+ * both formats), or an encoder asked to `end` has flushed out everything.
+ */
+class codec
+{
+public:
+    struct progress
+    {
+        size_t consumed;
+        size_t produced;
+        bool done;
+    };
+
+    virtual ~codec() = default;
+
+    virtual progress run(std::span<const std::byte> in,
+                         std::span<std::byte> out, bool end) = 0;
+};
+
+namespace detail {
+
+#if defined(EXAR_GZIP)
+class gzip_codec
+    : public codec
+{
+    z_stream zs {};
+    bool encode;
+
+public:
+    explicit gzip_codec(bool encode)
+        : encode { encode }
+    {
+        // 15 bits of window, +16 to write a gzip header, +32 to read any
+        int rc = encode
+            ? deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                           Z_DEFAULT_STRATEGY)
+            : inflateInit2(&zs, 15 + 32);
+        if (rc != Z_OK)
+            throw std::system_error { ENOMEM, std::generic_category(),
+                                      "zlib" };
+    }
+
+    ~gzip_codec()
+    {
+        if (encode)
+            deflateEnd(&zs);
+        else
+            inflateEnd(&zs);
+    }
+
+    progress run(std::span<const std::byte> in, std::span<std::byte> out,
+                 bool end) override
+    {
+        // zlib counts in 32 bits, so bigger spans go in several runs
+        zs.next_in = (Bytef*)in.data();
+        zs.avail_in = std::min<size_t>(in.size(), UINT_MAX);
+        zs.next_out = (Bytef*)out.data();
+        zs.avail_out = std::min<size_t>(out.size(), UINT_MAX);
+        auto avail_in = zs.avail_in, avail_out = zs.avail_out;
+
+        int rc = encode ? deflate(&zs, end ? Z_FINISH : Z_NO_FLUSH)
+                        : inflate(&zs, Z_NO_FLUSH);
+        if ((rc != Z_OK) && (rc != Z_STREAM_END) && (rc != Z_BUF_ERROR))
+            throw std::system_error { EBADMSG, std::generic_category(),
+                                      "gzip" };
+        progress p { avail_in - zs.avail_in, avail_out - zs.avail_out,
+                     rc == Z_STREAM_END };
+        // ready for another member to follow
+        if (p.done)
+            encode ? deflateReset(&zs) : inflateReset(&zs);
+        return p;
+    }
+};
+#endif
+
+#if defined(EXAR_ZSTD)
+class zstd_encoder
+    : public codec
+{
+    ZSTD_CCtx* cctx;
+
+public:
+    explicit zstd_encoder(size_t threads)
+        : cctx { ZSTD_createCCtx() }
+    {
+        if (!cctx)
+            throw std::system_error { ENOMEM, std::generic_category(),
+                                      "zstd" };
+        /* zstd's own workers compress blocks in parallel while we carry on
+         * feeding it; this quietly does nothing for a single-threaded
+         * libzstd, and 0 workers means all the work happens in our calls */
+        if (!threads)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        if (threads > 1)
+            ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, threads);
+        ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
+    }
+
+    ~zstd_encoder()
+    {
+        ZSTD_freeCCtx(cctx);
+    }
+
+    progress run(std::span<const std::byte> in, std::span<std::byte> out,
+                 bool end) override
+    {
+        ZSTD_inBuffer ib { in.data(), in.size(), 0 };
+        ZSTD_outBuffer ob { out.data(), out.size(), 0 };
+        auto rc = ZSTD_compressStream2(cctx, &ob, &ib,
+                                       end ? ZSTD_e_end : ZSTD_e_continue);
+        if (ZSTD_isError(rc))
+            throw std::system_error { EIO, std::generic_category(),
+                                      ZSTD_getErrorName(rc) };
+        return { ib.pos, ob.pos, end && !rc };
+    }
+};
+
+class zstd_decoder
+    : public codec
+{
+    ZSTD_DCtx* dctx;
+
+public:
+    zstd_decoder()
+        : dctx { ZSTD_createDCtx() }
+    {
+        if (!dctx)
+            throw std::system_error { ENOMEM, std::generic_category(),
+                                      "zstd" };
+    }
+
+    ~zstd_decoder()
+    {
+        ZSTD_freeDCtx(dctx);
+    }
+
+    progress run(std::span<const std::byte> in, std::span<std::byte> out,
+                 bool) override
+    {
+        ZSTD_inBuffer ib { in.data(), in.size(), 0 };
+        ZSTD_outBuffer ob { out.data(), out.size(), 0 };
+        auto rc = ZSTD_decompressStream(dctx, &ob, &ib);
+        if (ZSTD_isError(rc))
+            throw std::system_error { EBADMSG, std::generic_category(),
+                                      ZSTD_getErrorName(rc) };
+        // 0 means a frame just ended and everything in it is out
+        return { ib.pos, ob.pos, !rc };
+    }
+};
+#endif
+
+[[noreturn]] inline void unsupported(const char* name)
+{
+    throw std::system_error { ENOTSUP, std::generic_category(), name };
+}
+
+} // ::detail
+
+inline std::unique_ptr<codec> make_decoder(compression kind)
+{
+    switch (kind)
+    {
+    case compression::gzip:
+#if defined(EXAR_GZIP)
+        return std::make_unique<detail::gzip_codec>(false);
+#else
+        detail::unsupported("gzip");
+#endif
+    case compression::zstd:
+#if defined(EXAR_ZSTD)
+        return std::make_unique<detail::zstd_decoder>();
+#else
+        detail::unsupported("zstd");
+#endif
+    case compression::none:
+        break;
+    }
+    return nullptr;
+}
+
+/* `threads` as for thread_pool: 0 is one per CPU, 1 is just the caller */
+inline std::unique_ptr<codec> make_encoder(compression kind,
+                                           [[maybe_unused]] size_t threads)
+{
+    switch (kind)
+    {
+    case compression::gzip:
+#if defined(EXAR_GZIP)
+        return std::make_unique<detail::gzip_codec>(true);
+#else
+        detail::unsupported("gzip");
+#endif
+    case compression::zstd:
+#if defined(EXAR_ZSTD)
+        return std::make_unique<detail::zstd_encoder>(threads);
+#else
+        detail::unsupported("zstd");
+#endif
+    case compression::none:
+        break;
+    }
+    return nullptr;
+}
+
+/* decompress all of `data`, which has to end where a stream does */
+inline std::vector<std::byte> decompress(compression kind,
+                                         std::span<const std::byte> data)
+{
+    auto decoder = make_decoder(kind);
+    std::vector<std::byte> out(std::max<size_t>(data.size() * 4, 1 << 16));
+    size_t used = 0;
+    bool done = false;
+
+    while (!data.empty() || !done) {
+        if (used == out.size())
+            out.resize(out.size() * 2);
+        auto p = decoder->run(data, std::span { out }.subspan(used), true);
+        data = data.subspan(p.consumed);
+        used += p.produced;
+        if (p.consumed || p.produced)
+            done = p.done;
+        // no way forward with space left over means the input's cut short
+        if (!p.consumed && !p.produced && (used < out.size()))
+            throw std::system_error { EBADMSG, std::generic_category(),
+                                      "truncated" };
+    }
+    out.resize(used);
+    return out;
+}
+
+/*
+ * Stream buffer that reads from another stream, and decompresses it on the
+ * way if it turns out to be compressed, so that forward-only readers don't
+ * need to know the difference.
+ */
+class decoding_buf
+    : public std::streambuf
+{
+    std::istream& source;
+    std::unique_ptr<codec> decoder;
+    std::vector<std::byte> in, out;
+    size_t start = 0, end = 0;
+    bool sniffed = false, done = true;
+
+public:
+    explicit decoding_buf(std::istream& source, size_t size = 1 << 20)
+        : source { source }
+        , in(size)
+        , out(size)
+    {}
+
+protected:
+    int_type underflow() override
+    {
+        for (;;) {
+            bool more = (start < end) || fill();
+            if (!sniffed && more) {
+                sniffed = true;
+                decoder = make_decoder(detect_compression(
+                    std::span { in }.subspan(start, end - start)));
+            }
+            std::span<std::byte> chunk;
+            if (!decoder) {
+                // not compressed after all, so just hand it over
+                if (!more)
+                    return traits_type::eof();
+                chunk = std::span { in }.subspan(start, end - start);
+                start = end;
+            } else {
+                auto p = decoder->run(std::span { in }.subspan(start,
+                                                               end - start),
+                                      out, false);
+                start += p.consumed;
+                if (p.consumed || p.produced)
+                    done = p.done;
+                chunk = std::span { out }.first(p.produced);
+                if (chunk.empty() && !more) {
+                    if (!done)
+                        throw std::system_error { EBADMSG,
+                                                  std::generic_category(),
+                                                  "truncated" };
+                    return traits_type::eof();
+                }
+            }
+            if (!chunk.empty()) {
+                auto base = (char*)chunk.data();
+                setg(base, base, base + chunk.size());
+                return traits_type::to_int_type(*base);
+            }
+        }
+    }
+
+private:
+    bool fill()
+    {
+        source.read((char*)in.data(), in.size());
+        start = 0;
+        end = source.gcount();
+        return end > 0;
+    }
+};
@@ -13,10 +13,21 @@
   You should have received a copy of the GNU General Public License along with
   this software; if not see <http://www.gnu.org/licenses/>. */
 
+#pragma once
+
+#include <array>
+#include <algorithm>
+#include <bit>
 #include <cstdint>
-#include <utility>
+#include <cstring>
 #include <concepts>
 #include <ostream>
+#include <span>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 enum class endian
 {
@@ -35,26 +46,32 @@ enum class endian
 
 namespace detail {
 
-union helper16
-{
-    uint16_t u;
-    int16_t  i;
-    uint8_t  b[2];
-};
-union helper32
+/* reverse all the bytes, which compilers turn into a single instruction */
+template <std::integral T>
+constexpr T byteswap(T value)
 {
-    uint32_t u;
-    int32_t  i;
-    uint8_t  b[4];
-    helper16 q[2];
-};
-union helper64
+#if defined(__cpp_lib_byteswap)
+    return std::byteswap(value);
+#else
+    using U = std::make_unsigned_t<T>;
+    if constexpr (sizeof(T) == 2)
+        return static_cast<T>(__builtin_bswap16(static_cast<U>(value)));
+    else if constexpr (sizeof(T) == 4)
+        return static_cast<T>(__builtin_bswap32(static_cast<U>(value)));
+    else
+        return static_cast<T>(__builtin_bswap64(static_cast<U>(value)));
+#endif
+}
+
+/* swap the two bytes of every 16-bit half, leaving the halves in place */
+template <std::integral T>
+constexpr T pairswap(T value)
 {
-    uint64_t u;
-    int64_t  i;
-    uint8_t  b[8];
-    helper16 q[4];
-};
+    using U = std::make_unsigned_t<T>;
+    constexpr U low = U(~U(0)) / 0xffff * 0x00ff;
+    auto u = static_cast<U>(value);
+    return static_cast<T>(U(((u & low) << 8) | ((u >> 8) & low)));
+}
 
 } // ::detail
 
@@ -81,7 +98,7 @@ struct endian_swap<I, endian::little, endian::big>
 };
 
 template <size_t I, endian To>
-    requires (I > 1)
+    requires (I > 1) && (To != endian::mixed)
 struct endian_swap<I, endian::mixed, To>
 {
     using base = endian_swap<I, To, endian::mixed>;
@@ -98,168 +115,142 @@ struct endian_swap<1, From, To>
     { return value; }
 };
 
-
-template <>
-struct endian_swap<2, endian::big, endian::little>
+template <size_t I>
+    requires (I > 1)
+struct endian_swap<I, endian::big, endian::little>
 {
-    static constexpr auto _swap(detail::helper16&& h)
-    {
-        std::swap(h.b[0], h.b[1]);
-        return std::forward<detail::helper16>(h);
-    }
-    template <std::unsigned_integral U>
-    static constexpr uint16_t swap(U value)
-    { return _swap({ .u = value }).u; }
-    template <std::signed_integral S>
-    static constexpr int16_t swap(S value)
-    { return _swap({ .i = value }).i; }
+    template <std::integral T>
+        requires (sizeof(T) == I)
+    static constexpr T swap(T value)
+    { return detail::byteswap(value); }
 };
 
-template <>
-struct endian_swap<4, endian::big, endian::little>
+/* PDP-11 order: 16-bit halves most significant first, each little endian */
+template <size_t I>
+    requires (I > 1)
+struct endian_swap<I, endian::big, endian::mixed>
 {
-    static constexpr auto _swap(detail::helper32&& h)
-    {
-        std::swap(h.b[0], h.b[3]);
-        std::swap(h.b[1], h.b[2]);
-        return std::forward<detail::helper32>(h);
-    }
-    template <std::unsigned_integral U>
-    static constexpr uint32_t swap(U value)
-    { return _swap({ .u = value }).u; }
-    template <std::signed_integral S>
-    static constexpr int32_t swap(S value)
-    { return _swap({ .i = value }).i; }
+    template <std::integral T>
+        requires (sizeof(T) == I)
+    static constexpr T swap(T value)
+    { return detail::pairswap(value); }
 };
 
-template <>
-struct endian_swap<8, endian::big, endian::little>
+/* which leaves the bytes of each half alone, but reverses the halves */
+template <size_t I>
+    requires (I > 1)
+struct endian_swap<I, endian::little, endian::mixed>
 {
-    static constexpr auto _swap(detail::helper64&& h)
-    {
-        std::swap(h.b[0], h.b[7]);
-        std::swap(h.b[1], h.b[6]);
-        std::swap(h.b[2], h.b[5]);
-        std::swap(h.b[3], h.b[4]);
-        return std::forward<detail::helper64>(h);
-    }
-    template <std::unsigned_integral U>
-    static constexpr uint64_t swap(U value)
-    { return _swap({ .u = value }).u; }
-    template <std::signed_integral S>
-    static constexpr int64_t swap(S value)
-    { return _swap({ .i = value }).i; }
+    template <std::integral T>
+        requires (sizeof(T) == I)
+    static constexpr T swap(T value)
+    { return detail::byteswap(detail::pairswap(value)); }
 };
 
-template <>
-struct endian_swap<2, endian::big, endian::mixed>
+template <endian From, endian To = endian::native, std::integral I>
+constexpr auto swap_endian(I value)
 {
-    static constexpr auto _swap(detail::helper16&& h)
-    {
-        std::swap(h.b[0], h.b[1]);
-        return std::forward<detail::helper16>(h);
-    }
-    template <std::unsigned_integral U>
-    static constexpr uint16_t swap(U value)
-    { return _swap({ .u = value }).u; }
-    template <std::signed_integral S>
-    static constexpr int16_t swap(S value)
-    { return _swap({ .i = value }).i; }
-};
+    return endian_swap<sizeof(I), From, To>::swap(value);
+}
 
-template <>
-struct endian_swap<4, endian::big, endian::mixed>
+template <endian From, endian To = endian::native, std::integral O, std::integral I>
+constexpr auto swap_endian_to(I value, const O&)
 {
-    static constexpr auto _swap(detail::helper32&& h)
-    {
-        std::swap(h.b[0], h.b[1]);
-        std::swap(h.b[2], h.b[3]);
-        return std::forward<detail::helper32>(h);
-    }
-    template <std::unsigned_integral U>
-    static constexpr uint32_t swap(U value)
-    { return _swap({ .u = value }).u; }
-    template <std::signed_integral S>
-    static constexpr int32_t swap(S value)
-    { return _swap({ .i = value }).i; }
-};
+    return endian_swap<sizeof(O), From, To>::swap(static_cast<O>(value));
+}
 
-template <>
-struct endian_swap<8, endian::big, endian::mixed>
-{
-    static constexpr auto _swap(detail::helper64&& h)
-    {
-        std::swap(h.b[0], h.b[1]);
-        std::swap(h.b[2], h.b[3]);
-        std::swap(h.b[4], h.b[5]);
-        std::swap(h.b[6], h.b[7]);
-        return std::forward<detail::helper64>(h);
-    }
-    template <std::unsigned_integral U>
-    static constexpr uint64_t swap(U value)
-    { return _swap({ .u = value }).u; }
-    template <std::signed_integral S>
-    static constexpr int64_t swap(S value)
-    { return _swap({ .i = value }).i; }
-};
+namespace detail {
 
-template <>
-struct endian_swap<2, endian::little, endian::mixed>
+/* where swapping puts each byte: byte k of the result is byte order[k] */
+template <endian From, endian To, std::integral T>
+constexpr auto byte_order()
 {
-    template <std::unsigned_integral U>
-    static constexpr uint16_t swap(U value)
-    { return value; }
-    template <std::signed_integral S>
-    static constexpr int16_t swap(S value)
-    { return value; }
-};
+    std::array<uint8_t, sizeof(T)> bytes;
+    for (size_t k = 0; k < sizeof(T); ++k)
+        bytes[k] = k;
+    auto value = std::bit_cast<std::make_unsigned_t<T>>(bytes);
+    return std::bit_cast<decltype(bytes)>(swap_endian<From, To>(value));
+}
 
-template <>
-struct endian_swap<4, endian::little, endian::mixed>
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * Swap as many whole 16-byte blocks of `values` as there are with pshufb,
+ * and return how many values that covered. Only call this after checking
+ * that the CPU has SSSE3.
+ */
+template <endian From, endian To, std::integral T>
+__attribute__((target("ssse3")))
+inline size_t shuffle_ssse3(std::span<T> values)
 {
-    static constexpr auto _swap(detail::helper32&& h)
-    {
-        std::swap(h.q[0].u, h.q[1].u);
-        return std::forward<detail::helper32>(h);
-    }
-    template <std::unsigned_integral U>
-    static constexpr uint32_t swap(U value)
-    { return _swap({ .u = value }).u; }
-    template <std::signed_integral S>
-    static constexpr int32_t swap(S value)
-    { return _swap({ .i = value }).i; }
-};
+    static constexpr auto lanes = [] {
+        constexpr auto order = byte_order<From, To, T>();
+        std::array<uint8_t, 16> lanes;
+        for (size_t k = 0; k < lanes.size(); ++k)
+            lanes[k] = k - k % sizeof(T) + order[k % sizeof(T)];
+        return lanes;
+    }();
+    auto mask = _mm_loadu_si128((const __m128i*)lanes.data());
+    auto bytes = (char*)values.data();
+    size_t blocks = values.size_bytes() / 16;
 
-template <>
-struct endian_swap<8, endian::little, endian::mixed>
-{
-    static constexpr auto _swap(detail::helper64&& h)
-    {
-        std::swap(h.q[0].u, h.q[3].u);
-        std::swap(h.q[1].u, h.q[2].u);
-        return std::forward<detail::helper64>(h);
+    for (size_t i = 0; i < blocks; ++i) {
+        auto p = (__m128i*)(bytes + i * 16);
+        _mm_storeu_si128(p, _mm_shuffle_epi8(_mm_loadu_si128(p), mask));
     }
-    template <std::unsigned_integral U>
-    static constexpr uint64_t swap(U value)
-    { return _swap({ .u = value }).u; }
-    template <std::signed_integral S>
-    static constexpr int64_t swap(S value)
-    { return _swap({ .i = value }).i; }
-};
-
-template <endian From, endian To = endian::native, std::integral I>
-constexpr auto swap_endian(I value)
-{
-    return endian_swap<sizeof(I), From, To>::swap(value);
+    return blocks * 16 / sizeof(T);
 }
+#endif
 
-template <endian From, endian To = endian::native, std::integral O, std::integral I>
-constexpr auto swap_endian_to(I value, const O&)
+} // ::detail
+
+/*
+ * Convert a whole array in place, e.g. a table of offsets, 16 bytes at a time
+ * where the CPU can shuffle bytes around that way, and one value at a time
+ * for the rest.
+ */
+template <endian From, endian To = endian::native, std::integral T,
+          size_t N>
+constexpr void swap_endian_span(std::span<T, N> values)
 {
-    return endian_swap<sizeof(O), From, To>::swap(static_cast<O>(value));
+    constexpr auto order = detail::byte_order<From, To, T>();
+    if constexpr (std::ranges::is_sorted(order))
+        return;
+    size_t done = 0;
+
+    if !consteval {
+#if defined(__x86_64__) || defined(__i386__)
+        if ((sizeof(T) > 1) && __builtin_cpu_supports("ssse3"))
+            done = detail::shuffle_ssse3<From, To>(std::span<T> { values });
+#endif
+    }
+    for (auto& value : values.subspan(done))
+        value = swap_endian<From, To>(value);
 }
 
-std::ostream& operator<<(std::ostream& os, endian endianness)
+static_assert(swap_endian<endian::big, endian::little>(uint16_t(0x1122))
+              == 0x2211);
+static_assert(swap_endian<endian::little, endian::big>(int32_t(0x11223344))
+              == 0x44332211);
+static_assert(swap_endian<endian::big, endian::little>(
+                  uint64_t(0x1122334455667788)) == 0x8877665544332211);
+static_assert(swap_endian<endian::big, endian::mixed>(uint32_t(0x11223344))
+              == 0x22114433);
+static_assert(swap_endian<endian::little, endian::mixed>(uint16_t(0x1122))
+              == 0x1122);
+static_assert(swap_endian<endian::little, endian::mixed>(uint32_t(0x11223344))
+              == 0x33441122);
+static_assert(swap_endian<endian::mixed, endian::little>(
+                  uint64_t(0x1122334455667788)) == 0x7788556633441122);
+static_assert(swap_endian<endian::mixed, endian::big>(int16_t(-2)) == -257);
+static_assert(swap_endian_to<endian::big, endian::little>(1, uint32_t())
+              == 0x01000000);
+static_assert([] {
+    uint32_t values[] = { 0x11223344, 0x55667788, 0x99aabbcc };
+    swap_endian_span<endian::big, endian::mixed>(std::span { values });
+    return (values[0] == 0x22114433) && (values[2] == 0xaa99ccbb);
+}());
+
+inline std::ostream& operator<<(std::ostream& os, endian endianness)
 {
     switch (endianness)
     {
@@ -26,691 +26,839 @@
 #include <vector>
 #include <filesystem>
 #include <cstdarg>
+#include <chrono>
+#include <iomanip>
+#include <span>
+#include <system_error>
+#include <charconv>
+#include <array>
+#include <optional>
+#include <algorithm>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <atomic>
 
 #define VERSION "0.1"
 
-#if __has_include(<spanstream>)
-#define use_spanstream 1
-#include <spanstream>
-#else
-#define use_spanstream 0
-#include <strstream>
-#endif
-
 #include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
-#include "endian.hpp"
-#include "ar.hpp"
-
-namespace fs = std::filesystem;
-
-
+#include "archive.hpp"
+#include "hash.hpp"
 
-using shared_istream = std::shared_ptr<std::istream>;
 
-class Archive;
-using shared_archive = std::shared_ptr<Archive>;
-
-
-auto make_memory_stream(char* buf, size_t size)
+/*
+ * An archive as it was parsed some earlier time, straight from the cache.
+ * Its members only have content if the archive itself was opened as well.
+ */
+class cached_archive
+    : public Archive
 {
-#if use_spanstream
-    // this is the clean way to do this for C++23
-    return std::make_shared<std::spanstream>(
-        std::span { buf, (size_t)size }
-    );
-#else
-    // ...but libc++ (clang) sucks and lacks spanstream? really?
-    auto ss = std::make_shared<std::strstream>(
-        buf, (int)size, std::ios::in | std::ios::binary
-    );
-    /* XXX: ...why?! If we don't do this, we'll always fail to parse, which
-     *      makes...  no sense at all. It seems like it fails to understand the
-     *      buffer we're working with or something? (seeking to 5, then to 0
-     *      works, but seeking to 1, then to 0 doesn't...) This pretty clearly
-     *      seems like a bug, but frankly... this is the deprecated, -wrong- to
-     *      do this, but we don't have spanstream on macOS/Clang, soooo... */
-    ss->seekg(0, std::ios::end);
-    ss->seekg(0);
-    return ss;
-#endif
-}
+    std::string _description;
 
-
-constexpr size_t align(size_t value, size_t alignment)
-{
-    return value + (value % alignment);
-}
-
-
-template <class T>
-struct format_arg
-{
-    static auto get(const T& value)
+public:
+    cached_archive(shared_input input, std::string description,
+                   std::vector<entry>&& headers)
+        : Archive { input }
+        , _description { std::move(description) }
     {
-        return value;
+        for (auto& ent : headers) {
+            ent.input = input.get();
+            add_header(ent);
+        }
     }
 
-    static auto get(T&& value)
+    virtual std::string description() const
     {
-        return std::forward<T>(value);
+        return _description;
     }
 };
 
-template <>
-struct format_arg<std::string>
+/*
+ * On-disk cache of parsed archives, so that looking at the same unchanged
+ * archive over and over only ever walks its headers once. Each archive gets
+ * a file named after (and holding) its device, inode, size and modification
+ * time, with the format's description and the header table in host order.
+ * Anything unexpected in there is just a miss.
+ */
+class archive_cache
 {
-    static auto get(const std::string& value)
-    {
-        return value.c_str();
-    }
-};
+    static constexpr std::string_view magic = "exarix01";
 
-template <>
-struct format_arg<std::string_view>
-{
-    static auto get(std::string_view value)
-    {
-        return value.data();
-    }
-};
-
-template <size_t N, class... Args>
-void __attribute__((format(printf, 2, 3)))
-    format_field(char (&field)[N], const char* format, ...)
-{
-    va_list ap;
-    char buf[N+1];
-    memset(buf, 0, sizeof(buf));
-    va_start(ap, format);
-    vsnprintf(buf, sizeof(buf), format, ap);
-    va_end(ap);
-    memcpy(field, buf, std::min(strnlen(buf, sizeof(buf)), N));
-}
+    fs::path _dir;
 
+    struct key
+    {
+        uint64_t dev, ino, size, sec, nsec;
 
-template <class T, char End, size_t Base, size_t N>
-struct field_parser;
+        bool operator==(const key&) const = default;
+    };
 
-template <char End, size_t Base, size_t N>
-struct field_parser<std::string_view, End, Base, N>
-{
-    static std::string_view parse(const char (&buf)[N])
+    static std::optional<key> key_of(const fs::path& path)
     {
-        constexpr auto npos = std::string_view::npos;
-        if constexpr (End == 0) {
-            return { buf, strnlen(buf, N) };
-        } else {
-            std::string_view sv = { buf, N };
-            auto p = sv.find(End);
-            return { p == npos ? sv : sv.substr(0, p) };
-        }
+        struct stat st;
+        if ((stat(path.c_str(), &st) < 0) || !S_ISREG(st.st_mode))
+            return {};
+        return key { (uint64_t)st.st_dev, (uint64_t)st.st_ino,
+                     (uint64_t)st.st_size, (uint64_t)st.st_mtim.tv_sec,
+                     (uint64_t)st.st_mtim.tv_nsec };
     }
-};
 
-template <char End, size_t Base, size_t N>
-struct field_parser<std::string, End, Base, N>
-{
-    static std::string parse(const char (&buf)[N])
+    fs::path file_for(const key& k) const
     {
-        return std::string { field_parser<std::string_view, End, Base, N>::parse(buf) };
+        char name[32];
+        auto h = xxh64::hash({ (const std::byte*)&k, sizeof(k) });
+        snprintf(name, sizeof(name), "%016llx.idx", (unsigned long long)h);
+        return _dir / name;
     }
-};
 
-template <std::signed_integral S, char End, size_t Base, size_t N>
-struct field_parser<S, End, Base, N>
-{
-    static S parse(const char (&buf)[N])
-    {
-        auto sv = field_parser<std::string, End, Base, N>::parse(buf);
-        return static_cast<S>(std::stoll(sv, nullptr, Base));
-    }
-};
+public:
+    explicit archive_cache(const fs::path& dir)
+        : _dir { dir }
+    {}
 
-template <std::unsigned_integral U, char End, size_t Base, size_t N>
-struct field_parser<U, End, Base, N>
-{
-    static U parse(const char (&buf)[N])
+    /*
+     * Detect the archive at `path`, from the cache if it's there, or else
+     * the hard way (and then remember it). Members only get content to read
+     * if `content` is set: once an archive's cached, knowing what's in it
+     * doesn't take opening it at all.
+     */
+    shared_archive open(const fs::path& path, const detector& detect,
+                        bool content) const
     {
-        auto sv = field_parser<std::string, End, Base, N>::parse(buf);
-        return static_cast<U>(std::stoull(sv, nullptr, Base));
+        // taken before reading, so a change while we do is a miss next time
+        auto k = key_of(path);
+        auto in = content ? open_archive(path) : nullptr;
+        if (!k)
+            return detect(in ? in : open_archive(path));
+        if (auto archive = load(*k, in))
+            return archive;
+        if (!in)
+            in = open_archive(path);
+        auto archive = detect(in);
+        store(*k, *archive);
+        return archive;
     }
-};
-
-template <class T = std::string_view, char End = 0, size_t Base = 10, size_t N>
-auto parse_field(const char (&buf)[N])
-{
-    return field_parser<T, End, Base, N>::parse(buf);
-}
-
-template <char End = 0, size_t Base = 10, class T = std::string_view, size_t N>
-void parse_field_into(T* field, const char (&buf)[N])
-{
-    *field = field_parser<T, End, Base, N>::parse(buf);
-}
-
-template <size_t N>
-void write_stringstream_into_field(char (&field)[N], std::stringstream ss)
-{
-    auto s = ss.str();
-    memcpy(field, s.data(), std::min(N, s.size()));
-}
 
-struct entry
-{
-    std::string_view path;
-    shared_istream stream;
-    size_t header_offset;
-    size_t content_offset;
-    size_t content_size;
-
-    std::string name;
-    unsigned long date;
-    unsigned uid;
-    unsigned gid;
-    unsigned mode;
-
-    void copy_content_to(std::ostream& os, size_t alignment = 1) const
+private:
+    shared_archive load(const key& k, shared_input content) const
     {
-        char buf[10240];
-        size_t remain = content_size, len;
-
-        stream->seekg(content_offset);
+        shared_input in;
+        try {
+            in = open_input(file_for(k));
+        } catch (std::system_error&) {
+            return nullptr;
+        }
 
-        while (remain) {
-            stream->read(buf, std::min(remain, sizeof(buf)));
-            if (!(len = stream->gcount()))
-                break;
-            os.write(buf, len);
-            remain -= len;
+        auto data = in->data();
+        size_t pos = 0;
+        auto take = [&](void* value, size_t size) {
+            if (data.size() - pos < size)
+                return false;
+            memcpy(value, data.data() + pos, size);
+            pos += size;
+            return true;
+        };
+        auto take_string = [&](auto& value) {
+            uint32_t size;
+            if (!take(&size, sizeof(size)) || (data.size() - pos < size))
+                return false;
+            value = { (const char*)data.data() + pos, size };
+            pos += size;
+            return true;
+        };
+
+        char head[magic.size()];
+        key stored;
+        std::string_view description;
+        uint64_t count;
+        if (!take(head, sizeof(head)) || (std::string_view { head,
+                                          sizeof(head) } != magic)
+                || !take(&stored, sizeof(stored)) || (stored != k)
+                || !take_string(description) || !take(&count, sizeof(count)))
+            return nullptr;
+        // the entries view the cache file, which is around until they're added
+        std::vector<entry> headers;
+        for (uint64_t i = 0; i < count; ++i) {
+            auto& ent = headers.emplace_back();
+            uint64_t offsets[4];
+            uint32_t ids[3];
+            if (!take(offsets, sizeof(offsets)) || !take(ids, sizeof(ids))
+                    || !take_string(ent.name) || !take_string(ent.external))
+                return nullptr;
+            ent.header_offset = offsets[0];
+            ent.content_offset = offsets[1];
+            ent.content_size = offsets[2];
+            ent.date = offsets[3];
+            ent.uid = ids[0];
+            ent.gid = ids[1];
+            ent.mode = ids[2];
         }
-        if (remain) {
-            memset(buf, 0, sizeof(buf));
-            while (remain) {
-                os.write(buf, std::min(remain, sizeof(buf)));
-                remain -= len;
-            }
+        return std::make_shared<cached_archive>(content,
+                                                std::string { description },
+                                                std::move(headers));
+    }
+
+    /* remember how an archive parsed; failing to is no problem */
+    void store(const key& k, const Archive& archive) const
+    {
+        std::string out { magic };
+        auto put = [&](const void* value, size_t size) {
+            out.append((const char*)value, size);
+        };
+        auto put_string = [&](std::string_view value) {
+            uint32_t size = value.size();
+            put(&size, sizeof(size));
+            out.append(value);
+        };
+        put(&k, sizeof(k));
+        put_string(archive.description());
+        uint64_t count = archive.get_headers().size();
+        put(&count, sizeof(count));
+        for (auto ent : archive.get_headers()) {
+            uint64_t offsets[4] = { ent.header_offset, ent.content_offset,
+                                    ent.content_size, ent.date };
+            uint32_t ids[3] = { ent.uid, ent.gid, ent.mode };
+            put(offsets, sizeof(offsets));
+            put(ids, sizeof(ids));
+            put_string(ent.name);
+            // relative paths are relative to where we are now, not later
+            put_string(ent.external.empty()
+                       ? std::string {}
+                       : fs::absolute(fs::path { ent.external }).string());
         }
-        if ((len = content_size % alignment)) {
-            memset(buf, 0, len);
-            os.write(buf, len);
+
+        // written aside and renamed, so readers never see half of one
+        std::error_code ec;
+        fs::create_directories(_dir, ec);
+        auto target = file_for(k);
+        auto temp = target.string() + ".XXXXXX";
+        int fd = mkostemp(temp.data(), O_CLOEXEC);
+        if (fd < 0)
+            return;
+        try {
+            output o { fd, 0 };
+            o.write(out);
+            o.flush();
+            // the cache can be shared, even if mkostemp() assumes otherwise
+            fchmod(fd, 0644);
+        } catch (std::system_error&) {
+            ::close(fd);
+            ::unlink(temp.c_str());
+            return;
         }
+        ::close(fd);
+        if (rename(temp.c_str(), target.c_str()) < 0)
+            ::unlink(temp.c_str());
     }
 };
 
-const std::set<std::string_view> format_files {
-    "__.SYMDEF",
-    "__.SYMDEF SORTED",
-    "/",
-};
 
-class Archive
+/*
+ * For each of the archive's members, the index of the first member with
+ * exactly the same content (its own index if there isn't one). Payloads are
+ * hashed in parallel, and members whose hashes match are compared in full
+ * before being called duplicates.
+ */
+std::vector<size_t> find_duplicates(shared_archive archive, size_t threads)
 {
-protected:
-    shared_istream stream;
-    std::vector<entry> headers;
-
-    template <std::integral I>
-    bool check_magic(I magic)
-    {
-        constexpr auto size = sizeof(I);
-        union {
-            I value;
-            char data[size];
-        } u;
-
-        stream->seekg(0);
-        stream->read(u.data, size);
-
-        return (swap_endian<endian::little>(u.value) == magic)
-            || (swap_endian<endian::big   >(u.value) == magic)
-            || (swap_endian<endian::mixed >(u.value) == magic);
+    std::vector<entry> members;
+    for (auto e : archive->get_members())
+        members.push_back(e);
+
+    std::vector<uint64_t> hashes(members.size());
+    auto hash = [&](size_t i) {
+        auto& e = members[i];
+        auto source = e.source();
+        hashes[i] = xxh64::hash(source->view(e.content_offset,
+                                             e.content_size));
+    };
+    if (threads == 1) {
+        for (size_t i = 0; i < members.size(); ++i)
+            hash(i);
+    } else {
+        thread_pool pool { threads };
+        for (size_t i = 0; i < members.size(); ++i)
+            pool.submit([&hash, i] { hash(i); });
+        pool.wait();
     }
 
-    bool check_magic(std::string_view magic)
-    {
-        auto size = magic.size();
-        char data[size];
-        std::string_view value { data, size };
-
-        stream->seekg(0);
-        stream->read(data, size);
-
-        return value == magic;
+    auto same = [&](size_t a, size_t b) {
+        auto &x = members[a], &y = members[b];
+        if (x.content_size != y.content_size)
+            return false;
+        auto xs = x.source(), ys = y.source();
+        auto xv = xs->view(x.content_offset, x.content_size);
+        auto yv = ys->view(y.content_offset, y.content_size);
+        return std::ranges::equal(xv, yv);
+    };
+    std::vector<size_t> originals(members.size());
+    std::map<uint64_t, std::vector<size_t>> seen;
+    for (size_t i = 0; i < members.size(); ++i) {
+        originals[i] = i;
+        auto& candidates = seen[hashes[i]];
+        for (auto k : candidates) {
+            if (same(k, i)) {
+                originals[i] = k;
+                break;
+            }
+        }
+        if (originals[i] == i)
+            candidates.push_back(i);
     }
+    return originals;
+}
 
-public:
-    Archive(shared_istream stream)
-        : stream { stream }
-        , headers {}
-    {}
-
-    virtual std::string description() const
-    {
-        return "unknown archive format";
+/*
+ * Write an updated archive the way it was written before, so that as much
+ * of it as possible stays where it is: with the same kind of symbol index
+ * (if any), and the same kind of long names.
+ */
+void keep_style(shared_archive archive, write_options& options, bool index,
+                bool names)
+{
+    if (!index) {
+        options.index = symbol_index::none;
+        for (auto e : archive->get_format_members()) {
+            if ((e.name == "/") || (e.name == "/SYM64/"))
+                options.index = symbol_index::gnu;
+            else if (e.name.starts_with("__.SYMDEF"))
+                options.index = symbol_index::bsd;
+        }
     }
-
-    auto get_members() const
-    {
-        return headers | std::views::filter([](auto& e) {
-            return format_files.find(e.name) == format_files.end();
-        });
+    if (!names) {
+        // BSD names come between the header and the content
+        for (auto e : archive->get_members()) {
+            if (e.external.empty() && (e.content_offset - e.header_offset
+                                       > sizeof(common::current::ar_hdr)))
+                options.names = long_names::bsd;
+        }
+        for (auto e : archive->get_format_members()) {
+            if (e.name == "//")
+                options.names = long_names::gnu;
+        }
     }
-};
-
+}
 
-namespace common {
+/* tell the user about each member that `options` says is a duplicate */
+void report_duplicates(shared_archive archive, const write_options& options)
+{
+    std::vector<entry> members;
+    for (auto e : archive->get_members())
+        members.push_back(e);
+    for (size_t i = 0; i < members.size(); ++i) {
+        if (!options.duplicate(i))
+            continue;
+        auto& original = members[options.originals[i]];
+        std::cerr << "Duplicate member: " << members[i].name
+                  << " (same as " << original.name << ")" << std::endl;
+    }
+}
 
-template <class T> concept has_name = requires (T&& h) { h.ar_name; };
-template <class T> concept has_date = requires (T&& h) { h.ar_date; };
-template <class T> concept has_uid  = requires (T&& h) { h.ar_uid;  };
-template <class T> concept has_gid  = requires (T&& h) { h.ar_gid;  };
-template <class T> concept has_mode = requires (T&& h) { h.ar_mode; };
-template <class T> concept has_size = requires (T&& h) { h.ar_size; };
 
-template <auto Magic,
-          class Header,
-          size_t Alignment,
-          endian Endian>
-class Archive
-    : public ::Archive
+/*
+ * Forward-only reader for archives coming from somewhere we can neither map
+ * nor seek (a pipe, stdin). The format is picked from the leading magic alone,
+ * and members are handed out one at a time as they arrive; only the member
+ * currently being looked at is ever held in memory.
+ */
+class stream_reader
 {
-public:
-    using header_type = Header;
-    static constexpr auto alignment = Alignment;
-    static constexpr auto endianness = Endian;
-    static constexpr auto magic = Magic;
+    std::istream& is;
+    const probe_entry* fmt = nullptr;
+    std::string pending;
+    std::string names;
+    size_t pos = 0;
 
-    Archive(shared_istream stream)
-        : ::Archive { stream }
+    size_t read(void* buf, size_t size)
     {
-        if (!check_magic(magic))
-            throw std::exception {};
-        read_headers();
+        size_t done = std::min(size, pending.size());
+        memcpy(buf, pending.data(), done);
+        pending.erase(0, done);
+        if (done < size) {
+            is.read((char*)buf + done, size - done);
+            done += is.gcount();
+        }
+        pos += done;
+        return done;
     }
 
-    virtual std::string description() const
+    void skip(size_t size)
     {
-        std::stringstream ss;
-        ss << "unknown archive format, " << endianness;
-        return ss.str();
+        char buf[4096];
+        while (size && read(buf, std::min(size, sizeof(buf))))
+            size -= std::min(size, sizeof(buf));
     }
 
-protected:
-    void read_header(entry& ent)
+    [[noreturn]] static void malformed(const char* what)
     {
-        header_type hdr;
-        // prepopulate fields we already know about
-        ent.stream = stream;
-        ent.header_offset = stream->tellg();
-        ent.content_offset = ent.header_offset + sizeof(header_type);
-        // read header structure from the stream
-        stream->read((char*)&hdr, sizeof(hdr));
-        // name and content_size are required
-        ent.name = parse_field<std::string>(hdr.ar_name);
-        ent.content_size = swap_endian<endianness>(hdr.ar_size);
-        // any others may or may not appear
-        if constexpr (has_date<header_type>)
-            ent.date = swap_endian<endianness>(hdr.ar_date);
-        if constexpr (has_uid<header_type>)
-            ent.uid = swap_endian<endianness>(hdr.ar_uid);
-        if constexpr (has_gid<header_type>)
-            ent.gid = swap_endian<endianness>(hdr.ar_gid);
-        if constexpr (has_mode<header_type>)
-            ent.mode = swap_endian<endianness>(hdr.ar_mode);
+        throw std::system_error { EBADMSG, std::generic_category(), what };
     }
 
-    void read_headers()
+    /*
+     * Like a format's probe, but only over what's buffered so far: how many
+     * headers in a row make sense, or 0 if one doesn't. Unless `whole` says
+     * that's the entire archive, members that run past it just end the walk.
+     */
+    size_t score(const probe_entry& p, bool whole) const
     {
-        entry ent;
-        size_t pos = sizeof(magic);
-        size_t end = stream->seekg(0, std::ios::end).tellg();
-        while (pos <= (end - sizeof(header_type))) {
-            stream->seekg(pos);
-            read_header(ent);
+        std::span data { (const std::byte*)pending.data(), pending.size() };
+        size_t pos = p.magic.size(), count = 1;
+
+        while (pos + p.header_size <= data.size()) {
+            entry ent {};
+            try {
+                p.decode(data.subspan(pos, p.header_size), ent);
+            } catch (std::exception&) {
+                return 0;
+            }
             if (!ent.name.size() || (ent.name.at(0) == 0))
-                throw std::exception {};
-            headers.push_back(ent);
-            pos = ent.content_offset + align(ent.content_size, alignment);
+                return 0;
+            pos += p.header_size;
+            ++count;
+            if (!p.stored(ent))
+                continue;
+            if (ent.content_size > data.size() - pos) {
+                if (whole)
+                    return 0;
+                return count;
+            }
+            pos += align(ent.content_size, p.alignment);
         }
-        if (pos != end)
-            throw std::exception {};
+        return (!whole || (pos == data.size())) ? count : 0;
     }
 
-    static void write_entry(const entry& ent, std::ostream& stream)
+public:
+    static constexpr size_t lookahead = 1 << 20;
+
+    /*
+     * The 16-bit formats share their magic across byte orders, so when more
+     * than one format matches, up to `lookahead` bytes are buffered and
+     * scored the way identify_format scores a whole archive. If that's all
+     * there is, a tie goes to the first format, just as it does there;
+     * otherwise there's no telling how the rest would have scored.
+     */
+    explicit stream_reader(std::istream& is)
+        : is { is }
     {
-        header_type hdr;
-        // clear out header so we don't have any "bonus" data
-        memset((char*)&hdr, 0, sizeof(hdr));
-        // if our name is too large, then just truncate with a dumb hash
-        if (ent.name.size() > sizeof(hdr.ar_name)) {
-            unsigned short sum = 0;
-            for (size_t i = 0; i < ent.name.size(); ++i)
-                sum += ent.name.at(i);
-            sum += ent.name.size();
-            format_field(hdr.ar_name, "%.*s%04hx", (int)sizeof(hdr.ar_name)-4,
-                         ent.name.c_str(), sum);
-        } else {
-            format_field(hdr.ar_name, "%s", ent.name.c_str());
+        std::vector<const probe_entry*> candidates;
+        pending.resize(8);
+        is.read(pending.data(), pending.size());
+        pending.resize(is.gcount());
+        for (auto& p : probes) {
+            if (pending.starts_with(p.magic))
+                candidates.push_back(&p);
         }
-        // save the size for free too
-        hdr.ar_size = swap_endian_to<endianness>(ent.content_size, hdr.ar_size);
-        // now store any of the other fields we have
-        if constexpr (has_date<header_type>)
-            hdr.ar_date = swap_endian_to<endianness>(ent.date, hdr.ar_date);
-        if constexpr (has_uid<header_type>)
-            hdr.ar_uid = swap_endian_to<endianness>(ent.uid, hdr.ar_uid);
-        if constexpr (has_gid<header_type>)
-            hdr.ar_gid = swap_endian_to<endianness>(ent.gid, hdr.ar_gid);
-        if constexpr (has_mode<header_type>)
-            hdr.ar_mode = swap_endian_to<endianness>(ent.mode, hdr.ar_mode);
-        // and write the header and content out to the stream
-        stream.write((char*)&hdr, sizeof(hdr));
-        ent.copy_content_to(stream, alignment);
+        if (candidates.empty())
+            throw std::system_error { EINVAL, std::generic_category(),
+                                      "unrecognized archive format" };
+        fmt = candidates.front();
+
+        if (candidates.size() > 1) {
+            auto have = pending.size();
+            pending.resize(lookahead);
+            is.read(pending.data() + have, pending.size() - have);
+            pending.resize(have + is.gcount());
+            bool whole = pending.size() < lookahead;
+            size_t best = 0, ties = 0;
+            fmt = nullptr;
+            for (auto p : candidates) {
+                auto s = score(*p, whole);
+                if (s > best) {
+                    best = s;
+                    fmt = p;
+                    ties = 0;
+                } else if (s && (s == best)) {
+                    ++ties;
+                }
+            }
+            if (!fmt)
+                throw std::system_error { EINVAL, std::generic_category(),
+                                          "unrecognized archive format" };
+            if (ties && !whole)
+                throw std::system_error { EINVAL, std::generic_category(),
+                                          "ambiguous archive format, use -i "
+                                          "to pick one" };
+        }
+        skip(fmt->magic.size());
     }
 
-public:
-    static void write(std::ostream& os, shared_archive archive)
+    std::string_view format() const
     {
-        auto m = swap_endian<endian::native, Endian>(magic);
-        os.seekp(0);
-        os.write((char*)&m, sizeof(m));
-        for (auto& entry : archive->get_members()) {
-            write_entry(entry, os);
+        return fmt->format;
+    }
+
+    /* call `fn` with every entry in the archive, in order; each one is only
+     * good until `fn` returns */
+    template <class F>
+    void each(F&& fn)
+    {
+        std::vector<std::byte> hdr(fmt->header_size);
+        for (;;) {
+            entry ent {};
+            // a partial header at the end is ignored, same as when mapped
+            if (read(hdr.data(), hdr.size()) != hdr.size())
+                break;
+            ent.header_offset = pos - hdr.size();
+            try {
+                fmt->decode(hdr, ent);
+            } catch (std::system_error&) {
+                throw;
+            } catch (std::exception&) {
+                malformed("malformed header");
+            }
+            if (!ent.name.size() || (ent.name.at(0) == 0))
+                malformed("malformed header");
+            /* grow the buffer as data actually arrives, so a bogus size
+             * can't make us allocate more than the input really holds */
+            std::vector<std::byte> buf;
+            while (fmt->stored(ent) && (buf.size() < ent.content_size)) {
+                auto want = std::min<size_t>(ent.content_size - buf.size(),
+                                             1 << 20);
+                auto have = buf.size();
+                buf.resize(have + want);
+                auto got = read(buf.data() + have, want);
+                if (got < want)
+                    malformed("truncated member");
+            }
+            if (fmt->stored(ent))
+                skip(align(ent.content_size, fmt->alignment)
+                     - ent.content_size);
+            auto content = std::make_shared<const input>(std::move(buf));
+            ent.input = content.get();
+            ent.content_offset = 0;
+            try {
+                fmt->resolve(ent, names);
+            } catch (std::system_error&) {
+                throw;
+            } catch (std::exception&) {
+                malformed("malformed member name");
+            }
+            fn(ent);
         }
     }
 };
 
-template <template<endian> class A>
-std::shared_ptr<::Archive> detect(shared_istream is)
+
+/* `value` as a JSON string; bytes that aren't ASCII go through as they are */
+std::string json_string(std::string_view value)
 {
-    try {
-        return std::make_shared<A<endian::little>>(is);
-    } catch (std::exception&) {}
-    try {
-        return std::make_shared<A<endian::big>>(is);
-    } catch (std::exception&) {}
-    try {
-        return std::make_shared<A<endian::mixed>>(is);
-    } catch (std::exception&) {}
-    throw std::exception {};
+    std::string out { '"' };
+    for (unsigned char c : value) {
+        switch (c)
+        {
+        case '"':  out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (c < 0x20) {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out += buf;
+            } else {
+                out += (char)c;
+            }
+        }
+    }
+    out += '"';
+    return out;
 }
 
-namespace ancient {
-
-constexpr size_t alignment = 2;
+/* how members are listed */
+enum class list_style
+{
+    text,   // just the names, one per line
+    json,   // one array of objects
+    ndjson, // one object per line
+    tsv,    // a heading, then tab separated fields, one member per line
+};
 
-template <endian Endian>
-class Archive
-    : public common::Archive<magic, ar_hdr, alignment, Endian>
+/*
+ * Writes a listing of members in one of the styles above, one member at a
+ * time. The offset is where the member's header starts, which is the same
+ * whether the archive was mapped or streamed. Everything goes through the
+ * same output, whose buffer collects a great many lines per write(), and
+ * nothing is flushed until the end.
+ */
+class lister
 {
-public:
-    Archive(shared_istream is)
-        : common::Archive<magic, ar_hdr, alignment, Endian> { is }
-    {}
+    output& _out;
+    list_style _style;
+    std::string _line;
+    bool _first = true;
 
-    virtual std::string description() const
+    template <std::integral I>
+    void number(I value)
     {
-        std::stringstream ss;
-        ss << "ancient UNIX 16-bit archive format, " << this->endianness;
-        return ss.str();
+        char buf[24];
+        auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), value);
+        _line.append(buf, end);
     }
-};
 
-std::shared_ptr<::Archive> detect(shared_istream is)
-{
-    return common::detect<Archive>(is);
-}
+    /* tabs and line breaks would break up the table, so they're escaped */
+    void tsv_field(std::string_view value)
+    {
+        for (char c : value) {
+            switch (c)
+            {
+            case '\t':  _line += "\\t"; break;
+            case '\n':  _line += "\\n"; break;
+            case '\r':  _line += "\\r"; break;
+            case '\\': _line += "\\\\"; break;
+            default:    _line += c; break;
+            }
+        }
+    }
 
-} // ::ancient
+public:
+    lister(output& out, list_style style)
+        : _out { out }
+        , _style { style }
+    {
+        if (_style == list_style::json)
+            _out.write("[");
+        else if (_style == list_style::tsv)
+            _out.write("name\toffset\tsize\tdate\tuid\tgid\tmode\n");
+    }
 
-namespace old {
+    void add(const entry& e)
+    {
+        _line.clear();
+        switch (_style)
+        {
+        case list_style::text:
+            _line.append(e.name);
+            break;
 
-constexpr size_t alignment = 2;
+        case list_style::json:
+            _line += _first ? "\n" : ",\n";
+            [[fallthrough]];
+        case list_style::ndjson:
+            _line += "{\"name\":";
+            _line += json_string(e.name);
+            _line += ",\"offset\":";
+            number(e.header_offset);
+            _line += ",\"size\":";
+            number(e.content_size);
+            _line += ",\"date\":";
+            number(e.date);
+            _line += ",\"uid\":";
+            number(e.uid);
+            _line += ",\"gid\":";
+            number(e.gid);
+            _line += ",\"mode\":";
+            number(e.mode);
+            _line += "}";
+            break;
 
-template <endian Endian>
-class Archive
-    : public common::Archive<magic, ar_hdr, alignment, Endian>
-{
-public:
-    Archive(shared_istream is)
-        : common::Archive<magic, ar_hdr, alignment, Endian> { is }
-    {}
+        case list_style::tsv:
+            tsv_field(e.name);
+            for (uint64_t value : { (uint64_t)e.header_offset,
+                                    (uint64_t)e.content_size,
+                                    (uint64_t)e.date, (uint64_t)e.uid,
+                                    (uint64_t)e.gid, (uint64_t)e.mode }) {
+                _line += '\t';
+                number(value);
+            }
+            break;
+        }
+        if (_style != list_style::json)
+            _line += '\n';
+        _out.write(_line);
+        _first = false;
+    }
 
-    virtual std::string description() const
+    void finish()
     {
-        std::stringstream ss;
-        ss << "old UNIX 16-bit archive format, " << this->endianness;
-        return ss.str();
+        if (_style == list_style::json)
+            _out.write(_first ? "]\n" : "\n]\n");
+        _out.flush();
     }
 };
 
-
-std::shared_ptr<::Archive> detect(shared_istream is)
+/*
+ * Census of every archive under a directory tree, for sweeping firmware
+ * images and the like. Each directory is listed by a task on the pool, which
+ * queues up its subdirectories in turn; files only get read as far as their
+ * magic (through any compression), and the ones that might be archives are
+ * parsed by a task of their own. Every archive found is written out as soon
+ * as it is, as one line of JSON.
+ */
+class census
 {
-    return common::detect<Archive>(is);
-}
+    thread_pool& _pool;
+    std::ostream& _os;
+    std::mutex _lock;
+    std::atomic<bool> _failed { false };
 
-} // ::old
-
-namespace current {
-
-constexpr auto alignment = 2;
-
-class Archive
-    : public ::Archive
-{
 public:
-    Archive(shared_istream stream)
-        : ::Archive { stream }
-    {
-        if (!check_magic(magic))
-            throw std::exception {};
-        read_headers();
-    }
+    census(thread_pool& pool, std::ostream& os)
+        : _pool { pool }
+        , _os { os }
+    {}
 
-    virtual std::string description() const
+    /* false if anything couldn't be looked at */
+    bool ok() const
     {
-        return "current format archive";
+        return !_failed;
     }
 
-protected:
-    void read_header(entry& ent)
+    void walk(const fs::path& dir)
     {
-        ar_hdr hdr;
-        // prepopulate fields we already know about
-        ent.stream = stream;
-        ent.header_offset = stream->tellg();
-        ent.content_offset = ent.header_offset + sizeof(ar_hdr);
-        // read header data from the stream
-        stream->read((char*)&hdr, sizeof(hdr));
-        // make sure the file header magic matches
-        if (parse_field(hdr.ar_fmag) != fmag)
-            throw std::exception {};
-        // set up these fields first so we can process extended names
-        parse_field_into<' '>(&ent.content_size, hdr.ar_size);
-        // extract the name field from the struct
-        auto name = parse_field<std::string_view, ' '>(hdr.ar_name);
-        // if it's an extended name, find it, then move the boundaries around
-        if (name.starts_with(extended)) {
-            std::string lenstr { name.substr(extended.size()) };
-            auto namelen = std::stoull(lenstr);
-            char buf[namelen];
-            stream->read(buf, namelen);
-            ent.name = std::string { buf, strnlen(buf, namelen) };
-            ent.content_size -= namelen;
-            ent.content_offset += namelen;
-        // otherwise, our name is just our name
-        } else {
-            ent.name = std::string { name };
+        std::error_code ec;
+        auto options = fs::directory_options::skip_permission_denied;
+        for (fs::directory_iterator it { dir, options, ec }, end;
+                !ec && (it != end); it.increment(ec)) {
+            /* symlinks are never followed, so there's no going round in
+             * loops; an entry we can't look at (say it's just been removed)
+             * is reported, and the rest of the directory still gets walked */
+            std::error_code entry_ec;
+            auto type = it->symlink_status(entry_ec).type();
+            if (entry_ec) {
+                fail(it->path(), entry_ec.message());
+                continue;
+            }
+            switch (type)
+            {
+            case fs::file_type::directory:
+                _pool.submit([this, path = it->path()] { walk(path); });
+                break;
+            case fs::file_type::regular:
+                check(it->path());
+                break;
+            default:
+                break;
+            }
         }
-        // parse the remaining fields out
-        parse_field_into<' '>(&ent.date, hdr.ar_date);
-        parse_field_into<' '>(&ent.uid, hdr.ar_uid);
-        parse_field_into<' '>(&ent.gid, hdr.ar_gid);
-        parse_field_into<' ', 8>(&ent.mode, hdr.ar_mode);
+        if (ec)
+            fail(dir, ec.message());
     }
 
-    void read_headers()
+    /* parse the file later if its first bytes say it could be an archive */
+    void check(const fs::path& path)
     {
-        entry ent;
-        size_t pos = magic.size();
-        size_t end = stream->seekg(0, std::ios::end).tellg();
-        while (pos <= (end - sizeof(ar_hdr))) {
-            stream->seekg(pos);
-            read_header(ent);
-            if (!ent.name.size() || (ent.name.at(0) == 0))
-                throw std::exception {};
-            headers.push_back(ent);
-            pos = ent.content_offset + align(ent.content_size, alignment);
-        }
+        if (might_be_archive(path))
+            _pool.submit([this, path] { parse(path); });
     }
 
-    static void write_entry(const entry& ent, std::ostream& stream)
+private:
+    static bool might_be_archive(const fs::path& path)
     {
-        constexpr auto npos = std::string::npos;
-        std::stringstream ss, extra;
-        ar_hdr hdr;
-
-        memset(&hdr, ' ', sizeof(hdr));
-
-        if ((ent.name.find(' ') != npos)
-                || (ent.name.size() > sizeof(hdr.ar_name))) {
-            char buf[align(ent.name.size() + 1, 16)];
-            format_field(hdr.ar_name, "%s%lu", extended.data(), sizeof(buf));
-            memset(buf, 0, sizeof(buf));
-            snprintf(buf, sizeof(buf), "%s", ent.name.c_str());
-            extra.write(buf, sizeof(buf));
-        } else {
-            format_field(hdr.ar_name, "%s", ent.name.c_str());
+        char head[8];
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+        auto got = ::read(fd, head, sizeof(head));
+        ::close(fd);
+        if (got <= 0)
+            return false;
+        std::string_view magic { head, (size_t)got };
+
+        if (detect_compression({ (const std::byte*)head, (size_t)got })
+                != compression::none) {
+            // just far enough to see what's inside
+            try {
+                std::ifstream file { path, std::ios::in | std::ios::binary };
+                decoding_buf unpacked { file, 1 << 16 };
+                std::istream is { &unpacked };
+                is.read(head, sizeof(head));
+                magic = { head, (size_t)is.gcount() };
+            } catch (std::exception&) {
+                return false;
+            }
         }
-        auto e = extra.str();
-
-        format_field(hdr.ar_date, "%lu", ent.date);
-        format_field(hdr.ar_uid, "%u", ent.uid);
-        format_field(hdr.ar_gid, "%u", ent.gid);
-        format_field(hdr.ar_mode, "%o", ent.mode);
-        format_field(hdr.ar_size, "%lu", ent.content_size + e.size());
-        format_field(hdr.ar_fmag, "%s", fmag.data());
-
-        stream.write((char*)&hdr, sizeof(hdr));
-        stream.write(e.data(), e.size());
-        ent.copy_content_to(stream, alignment);
+        return std::ranges::any_of(probes, [&](auto& p) {
+            return magic.starts_with(p.magic);
+        });
     }
 
-public:
-    static void write(std::ostream& os, shared_archive archive)
+    void parse(const fs::path& path)
     {
-        os.seekp(0);
-        os.write(magic.data(), magic.size());
-        for (auto& entry : archive->get_members()) {
-            write_entry(entry, os);
+        try {
+            auto in = open_input(path);
+            auto kind = detect_compression(in->view(0, 4));
+            auto size = in->size();
+            if (kind != compression::none)
+                in = std::make_shared<const input>(decompress(kind,
+                                                              in->data()),
+                                                   path);
+            // plenty of other files start out like an old archive would
+            auto found = identify_format(in);
+            if (!found)
+                return;
+
+            // probe formats name the byte order last, if there is one
+            std::string_view format = found.format, order;
+            auto colon = format.rfind(':');
+            if ((colon != std::string_view::npos)
+                    && (format.ends_with(":little") || format.ends_with(":big")
+                        || format.ends_with(":mixed"))) {
+                order = format.substr(colon + 1);
+                format = format.substr(0, colon);
+            }
+
+            std::stringstream line;
+            line << "{\"path\":" << json_string(path.native())
+                 << ",\"format\":" << json_string(format)
+                 << ",\"endianness\":"
+                 << (order.empty() ? "null" : json_string(order))
+                 << ",\"members\":" << found.archive->get_members().size()
+                 << ",\"bytes\":" << size;
+            if (kind != compression::none)
+                line << ",\"compression\":"
+                     << json_string(kind == compression::gzip ? "gzip"
+                                                              : "zstd");
+            line << "}\n";
+            // whole lines at a time, and straight away
+            std::lock_guard guard { _lock };
+            _os << line.str() << std::flush;
+        } catch (std::exception& exc) {
+            fail(path, exc.what());
         }
     }
-};
-
-std::shared_ptr<::Archive> detect(shared_istream is)
-{
-    return std::make_shared<Archive>(is);
-}
-
-} // ::current
-
-} // ::common
-
-namespace bsd {
-
-namespace old3 {
-
-constexpr size_t alignment = 2;
-
-template <endian Endian>
-class Archive
-    : public common::Archive<magic, ar_hdr, alignment, Endian>
-{
-public:
-    Archive(shared_istream is)
-        : common::Archive<magic, ar_hdr, alignment, Endian> { is }
-    {}
 
-    virtual std::string description() const
+    void fail(const fs::path& path, std::string_view what)
     {
-        std::stringstream ss;
-        ss << "old BSD 32-bit archive format, " << this->endianness;
-        return ss.str();
+        _failed = true;
+        std::lock_guard guard { _lock };
+        std::cerr << "While scanning " << path << ", encountered an error: "
+                  << what << std::endl;
     }
 };
 
-std::shared_ptr<::Archive> detect(shared_istream is)
-{
-    return common::detect<Archive>(is);
-}
-
-} // ::old3
-
-} // ::bsd
-
-
-using detector = std::function<shared_archive(shared_istream)>;
-using constructor = std::function<void(std::ostream&, shared_archive)>;
-
-static std::map<std::string_view, std::pair<detector, constructor>> formats = {
-    { "current",          { common::current::detect,
-                            common::current::Archive::write } },
-    { "old",              { common::old::detect,
-                            common::old::Archive<endian::native>::write } },
-    { "old:little",       { common::old::detect,
-                            common::old::Archive<endian::little>::write } },
-    { "old:big",          { common::old::detect,
-                            common::old::Archive<endian::big>::write } },
-    { "old:mixed",        { common::old::detect,
-                            common::old::Archive<endian::mixed>::write } },
-    { "ancient",          { common::ancient::detect,
-                            common::ancient::Archive<endian::native>::write } },
-    { "ancient:little",   { common::ancient::detect,
-                            common::ancient::Archive<endian::little>::write } },
-    { "ancient:big",      { common::ancient::detect,
-                            common::ancient::Archive<endian::big>::write } },
-    { "ancient:mixed",    { common::ancient::detect,
-                            common::ancient::Archive<endian::mixed>::write } },
-    { "bsd:old",          { bsd::old3::detect,
-                            bsd::old3::Archive<endian::native>::write } },
-    { "bsd:old:little",   { bsd::old3::detect,
-                            bsd::old3::Archive<endian::little>::write } },
-    { "bsd:old:big",      { bsd::old3::detect,
-                            bsd::old3::Archive<endian::big>::write } },
-    { "bsd:old:mixed",    { bsd::old3::detect,
-                            bsd::old3::Archive<endian::mixed>::write } },
-};
 
-shared_archive detect_any_format(shared_istream is)
+/* a count given on the command line, if that's all there is to `text` */
+std::optional<size_t> parse_count(std::string_view text)
 {
-    auto functions = formats | std::views::transform(
-        [](auto& e) { return e.second.first; }
-    );
-    for (auto e : functions) {
-        try {
-            return e(is);
-        } catch (std::exception&) {}
-    }
-    throw std::exception {};
+    size_t value;
+    auto [p, ec] = std::from_chars(text.data(), text.data() + text.size(),
+                                   value);
+    if (text.empty() || (ec != std::errc {})
+            || (p != text.data() + text.size()))
+        return std::nullopt;
+    return value;
 }
 
 
-
 std::string_view prog;
 
 
-static constexpr auto arcv_opts = "hv";
+static constexpr auto arcv_opts = "hvj:";
 static constexpr option arcv_longopts[] = {
     { "help",       0, nullptr, 'h' },
     { "version",    0, nullptr, 'v' },
+    { "jobs",       1, nullptr, 'j' },
     { NULL },
 };
 
 void arcv_usage(std::ostream& os)
 {
-    os << "Usage: " << prog << " [-h/-v] <archive>..." << std::endl;
+    os << "Usage: " << prog << " [-h/-v] [-j<n>] <archive>..." << std::endl;
 }
 
 void arcv_version(std::ostream& os)
@@ -727,16 +875,141 @@ void arcv_help(std::ostream& os)
        << "Optional arguments:" << std::endl
        << "  -h/--help     print this help message" << std::endl
        << "  -v/--version  print program version information" << std::endl
+       << "  -j<n>/--jobs <n>" << std::endl
+       << "                convert archives on <n> threads (0 for one per CPU)"
+                           << " and print a summary" << std::endl
        << std::endl;
 }
 
+struct arcv_result
+{
+    bool converted = false;
+    size_t bytes = 0;
+    std::string message;
+};
+
+/*
+ * A uniquely named file next to `target`, removed again unless it's renamed
+ * over the target with commit(). Being on the same filesystem is what makes
+ * that rename atomic.
+ */
+class replacement
+{
+    fs::path _target;
+    std::string _path;
+    int _fd = -1;
+
+public:
+    replacement(const replacement&) = delete;
+    replacement& operator=(const replacement&) = delete;
+
+    explicit replacement(const fs::path& target)
+        : _target { target }
+    {
+        auto name = "." + target.filename().string() + ".XXXXXX";
+        _path = (target.parent_path() / name).string();
+        if ((_fd = mkostemp(_path.data(), O_CLOEXEC)) < 0)
+            throw std::system_error { errno, std::generic_category(), _path };
+    }
+
+    ~replacement()
+    {
+        if (_fd >= 0) {
+            ::close(_fd);
+            ::unlink(_path.c_str());
+        }
+    }
+
+    int fd() const
+    {
+        return _fd;
+    }
+
+    /* make sure the new contents are on disk, then swap them into place */
+    void commit(mode_t mode)
+    {
+        if ((fchmod(_fd, mode) < 0) || (fsync(_fd) < 0)
+                || (rename(_path.c_str(), _target.c_str()) < 0))
+            throw std::system_error { errno, std::generic_category(),
+                                      _target.string() };
+        ::close(_fd);
+        _fd = -1;
+    }
+};
+
+arcv_result arcv_convert(const fs::path& path)
+{
+    arcv_result result;
+    std::stringstream msg;
+    std::error_code ec;
+
+    switch (fs::status(path, ec).type())
+    {
+    // if it's a regular file, try to process it
+    case fs::file_type::regular:
+        try {
+            // convert whatever a symlink points at, not the link itself
+            auto target = fs::is_symlink(path) ? fs::canonical(path) : path;
+            auto in = open_input(target);
+            auto arc = detect_any_format(in);
+            /* the converted archive goes into a new file beside the old one,
+             * which only replaces it once it's complete, so the original is
+             * never left half-written */
+            replacement tmp { target };
+            output o { tmp.fd() };
+            common::current::Archive::write(o, arc, {});
+            o.flush();
+            tmp.commit((mode_t)(fs::status(target).permissions()
+                                & fs::perms::mask));
+            result.bytes = in->size();
+            msg << "Converted " << path;
+            result.converted = true;
+
+        } catch (std::exception& exc) {
+            msg << "While processing " << path
+                << ", encountered an error: " << exc.what();
+        }
+        break;
+
+    // it was... something else, so log an error and continue
+    case fs::file_type::not_found:
+        msg << "Skipping " << path << ": does not exist";
+        break;
+    case fs::file_type::none:
+    case fs::file_type::unknown:
+    default:
+        msg << "Skipping " << path << ": not a regular file";
+        break;
+    }
+    result.message = msg.str();
+    return result;
+}
+
+void arcv_report(const arcv_result& result)
+{
+    (result.converted ? std::cout : std::cerr) << result.message << std::endl;
+}
+
 int arcv_main(int argc, char **argv)
 {
     int opt;
+    bool batch = false;
+    size_t jobs = 1;
 
     while ((opt = getopt_long(argc, argv, arcv_opts, arcv_longopts, nullptr)) >= 0) {
         switch (opt)
         {
+        case 'j':
+            batch = true;
+            if (auto n = parse_count(optarg)) {
+                jobs = *n;
+            } else {
+                std::cerr << "invalid number of jobs: '" << optarg << "'"
+                          << std::endl;
+                arcv_usage(std::cerr);
+                return EXIT_FAILURE;
+            }
+            break;
         case 'h':
             arcv_help(std::cout);
             return EXIT_SUCCESS;
@@ -750,65 +1023,50 @@ int arcv_main(int argc, char **argv)
         }
     }
 
-    // process each path given on our command line
-    for (size_t i = optind; i < argc; ++i) {
-        fs::path path { argv[i] };
-        switch (fs::status(path).type())
-        {
-        // if it's a regular file, try to process it
-        case fs::file_type::regular:
-            {
-                // open our file, figure out the buffer size, then allocate
-                std::fstream f { path, std::ios::in };
-                f.seekg(0, std::ios::end);
-                size_t size = f.tellg();
-                auto buf = new char[size];
-                // actually try to process our input archive
-                try {
-                    // read the file contents into our buffer
-                    f.seekg(0);
-                    f.read(buf, size);
-                    if (f.gcount() != size)
-                        std::cerr << "While processing "
-                                  << path << ", expected " << size
-                                  << " bytes but read " << f.gcount()
-                                  << "; continuing." << std::endl;
-                    size = f.gcount();
-                    f.close();
-                    // build a memory stream, then parse the archive
-                    auto ss = make_memory_stream(buf, size);
-                    auto arc = detect_any_format(ss);
-                    // reopen the file, truncating it, then write the archive
-                    f.open(path, std::ios::out | std::ios::trunc);
-                    common::current::Archive::write(f, arc);
-                    std::cout << "Converted " << path << std::endl;
-
-                } catch (std::exception& exc) {
-                    std::cerr << "While processing " << path
-                              << ", encountered an error: " << exc.what()
-                              << std::endl;
-                }
-                // clean up our buffer
-                delete[] buf;
-            }
-            break;
+    // without a job count, process each path in turn as we always have
+    if (!batch) {
+        for (int i = optind; i < argc; ++i)
+            arcv_report(arcv_convert(argv[i]));
+        return EXIT_SUCCESS;
+    }
 
-        // it was... something else, so log an error and continue
-        case fs::file_type::not_found:
-            std::cerr << "Skipping " << path << ": does not exist" << std::endl;
-            break;
-        case fs::file_type::none:
-        case fs::file_type::unknown:
-        default:
-            std::cerr << "Skipping " << path << ": not a regular file"
-                      << std::endl;
-            break;
+    /* otherwise, hand every path to the pool, and report results in command
+     * line order once they're all in so the output doesn't depend on timing */
+    std::vector<arcv_result> results(argc - optind);
+    auto start = std::chrono::steady_clock::now();
+    {
+        thread_pool pool { jobs };
+        for (int i = optind; i < argc; ++i) {
+            pool.submit([&results, i, path = argv[i]] {
+                results[i - optind] = arcv_convert(path);
+            });
+        }
+        pool.wait();
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    size_t files = 0, bytes = 0;
+    for (auto& result : results) {
+        arcv_report(result);
+        if (result.converted) {
+            ++files;
+            bytes += result.bytes;
         }
     }
+    auto secs = std::max(elapsed.count(), 1e-9);
+    auto flags = std::cout.flags();
+    std::cout << "Converted " << files << " of " << results.size()
+              << " archives (" << bytes << " bytes) in "
+              << std::fixed << std::setprecision(3) << elapsed.count()
+              << "s: " << std::setprecision(1) << (files / secs)
+              << " files/s, " << (bytes / secs / (1 << 20)) << " MiB/s"
+              << std::endl;
+    std::cout.flags(flags);
     return EXIT_SUCCESS;
 }
 
-static constexpr auto opts = "hvCIxtci:f:";
+static constexpr auto opts = "hvCIxtcrqSi:f:s:n:l:z:dDj:b:k:";
 static constexpr option longopts[] = {
     { "help",           0, nullptr, 'h' },
     { "version",        0, nullptr, 'v' },
@@ -816,9 +1074,21 @@ static constexpr option longopts[] = {
     { "list",           0, nullptr, 't' },
     { "convert",        0, nullptr, 'C' },
     { "create",         0, nullptr, 'c' },
+    { "replace",        0, nullptr, 'r' },
+    { "append",         0, nullptr, 'q' },
     { "extract",        0, nullptr, 'x' },
+    { "scan",           0, nullptr, 'S' },
     { "input-format",   1, nullptr, 'i' },
     { "output-format",  1, nullptr, 'f' },
+    { "symbol-index",   1, nullptr, 's' },
+    { "long-names",     1, nullptr, 'n' },
+    { "format",         1, nullptr, 'l' },
+    { "compress",       1, nullptr, 'z' },
+    { "dedupe",         0, nullptr, 'd' },
+    { "deterministic",  0, nullptr, 'D' },
+    { "jobs",           1, nullptr, 'j' },
+    { "buffer-size",    1, nullptr, 'b' },
+    { "cache",          1, nullptr, 'k' },
     { NULL },
 };
 
@@ -830,12 +1100,15 @@ enum class run_action
     extract,
     list,
     create,
+    replace,
+    append,
+    scan,
 };
 
 void usage(std::ostream& os)
 {
-    os << "Usage: " << prog << " [-h/-v] (-I/-C/-t/-c/-x) [-i<fmt>] [-f<fmt>]"
-                               " <archive> [...]" << std::endl;
+    os << "Usage: " << prog << " [-h/-v] (-I/-C/-t/-c/-r/-q/-x/-S) [-i<fmt>]"
+                               " [-f<fmt>] <archive> [...]" << std::endl;
 }
 
 void version(std::ostream& os)
@@ -847,14 +1120,22 @@ void help(std::ostream& os)
 {
     os << "Usage: " << prog << " (-h/--help/-v/--version)" << std::endl
        << "       " << prog << " (-I/--identify) <archive>" << std::endl
-       << "       " << prog << " (-t/--list) [-i<fmt>] <archive>"
-                            << std::endl
-       << "       " << prog << " (-C/--convert) [-i<fmt>] [-f<fmt>] <archive>"
-                               " <output>" << std::endl
-       << "       " << prog << " (-c/--create) [-f<fmt>] <output> <path>..."
-                            << std::endl
-       << "       " << prog << " (-x/--extract) [-i<fmt>] <archive> [<path>...]"
+       << "       " << prog << " (-t/--list) [-i<fmt>] [-l<style>] <archive>"
                             << std::endl
+       << "       " << prog << " (-C/--convert) [-i<fmt>] [-f<fmt>] [-s<kind>]"
+                               " [-n<style>] [-b<n>]" << std::endl
+       << "                 [-z<codec>] [-d] [-j<n>] <archive> <output>"
+                             << std::endl
+       << "       " << prog << " (-c/--create) [-f<fmt>] [-s<kind>] [-n<style>]"
+                               " [-b<n>]" << std::endl
+       << "                 [-z<codec>] [-d] [-D] [-j<n>] <output> <path>..."
+                             << std::endl
+       << "       " << prog << " (-r/--replace/-q/--append) [-s<kind>] [-n<style>]"
+                               " [-d] [-D]" << std::endl
+       << "                 [-j<n>] <archive> <path>..." << std::endl
+       << "       " << prog << " (-x/--extract) [-i<fmt>] [-j<n>] <archive>"
+                               " [<path>...]" << std::endl
+       << "       " << prog << " (-S/--scan) [-j<n>] <dir>" << std::endl
        << std::endl
        << "Optional arguments:" << std::endl
        << "  -h/--help       print this help message" << std::endl
@@ -866,13 +1147,27 @@ void help(std::ostream& os)
        << "  -C/--convert    convert existing archive to another format"
                              << std::endl
        << "  -c/--create     create an archive from a set of files" << std::endl
+       << "  -r/--replace    replace members with files of the same name, or add"
+                             << std::endl
+       << "                  them to the end" << std::endl
+       << "  -q/--append     add files to the end of an archive" << std::endl
        << "  -x/--extract    extract files from an archive" << std::endl
+       << "  -S/--scan       find every archive under a directory, and print"
+                             << std::endl
+       << "                  one line of JSON for each (path, format,"
+                             << " endianness," << std::endl
+       << "                  members, bytes)" << std::endl
        << std::endl
        << "Positional arguments:" << std::endl
-       << "  <archive>       archive to operate on" << std::endl
-       << "  <output>        output archive to create" << std::endl
-       << "  <path>          [create] paths to files to add to archive"
+       << "  <archive>       archive to operate on, or '-' for stdin; gzip and"
+                             << std::endl
+       << "                  zstd compressed archives are read transparently"
                              << std::endl
+       << "  <output>        output archive to create, or '-' for stdout"
+                             << std::endl
+       << "  <path>          [create, replace, append] paths to files to add to"
+                             << std::endl
+       << "                  archive" << std::endl
        << "                  [extract] paths within the archive to extract"
                              << std::endl
        << std::endl
@@ -883,6 +1178,53 @@ void help(std::ostream& os)
        << "  -f<fmt>/--output-format <fmt>" << std::endl
        << "                  format of output archive, or '?' to list formats"
                              << std::endl
+       << "  -b<n>/--buffer-size <n>" << std::endl
+       << "                  [convert, create] bytes of output to collect per"
+                             << " write" << std::endl
+       << "                  (0 for none)" << std::endl
+       << "  -z<codec>/--compress <codec>" << std::endl
+       << "                  [convert, create] compress the output archive:"
+                             << std::endl
+       << "                  'zstd', 'gzip' or 'none' (default)" << std::endl
+       << "  -d/--dedupe     [convert, create] report members with identical"
+                             << std::endl
+       << "                  content,"
+       << " and drop them (or share one file, in thin archives)"
+                             << std::endl
+       << "  -D/--deterministic" << std::endl
+       << "                  [create, replace, append] store zero dates and"
+                             << " owners," << std::endl
+       << "                  and mode 644" << std::endl
+       << "  -j<n>/--jobs <n>" << std::endl
+       << "                  [extract] write members, [convert] hash members,"
+                             << std::endl
+       << "                  [create] open files, [-z zstd] compress, [scan]"
+                             << std::endl
+       << "                  walk and parse, on <n> threads (0 for one per"
+                             << " CPU," << std::endl
+       << "                  the default for -z zstd and scan)" << std::endl
+       << "  -s<kind>/--symbol-index <kind>" << std::endl
+       << "                  symbol index to build for current format output:"
+                             << std::endl
+       << "                  'gnu' (default), 'bsd' or 'none'" << std::endl
+       << "  -n<style>/--long-names <style>" << std::endl
+       << "                  how current format output stores long member"
+                             << " names:" << std::endl
+       << "                  'gnu' (default, one shared table) or 'bsd'"
+                             << std::endl
+       << "  -l<style>/--format <style>" << std::endl
+       << "                  [list] 'text' (default, just names), or each"
+                             << " member's name," << std::endl
+       << "                  header offset, size, date, uid, gid and mode as"
+                             << " 'json'," << std::endl
+       << "                  'ndjson' (an object per line) or 'tsv'"
+                             << std::endl
+       << "  -k<dir>/--cache <dir>" << std::endl
+       << "                  [identify, list, extract, convert] keep parsed"
+                             << std::endl
+       << "                  archives in <dir>, so unchanged ones are never"
+                             << std::endl
+       << "                  parsed again (default: $EXAR_CACHE)" << std::endl
        << std::endl;
 
 }
@@ -900,7 +1242,18 @@ int main(int argc, char **argv)
     std::string input;
     std::vector<std::string> operands;
     detector detect = detect_any_format;
-    constructor construct = common::current::Archive::write;
+    const format* target = &formats.at("current");
+    bool forced_input = false;
+    write_options options;
+    size_t threads = 1;
+    bool threads_given = false;
+    size_t buffer = output::default_buffer;
+    bool dedupe = false;
+    bool deterministic = false;
+    bool index_given = false, names_given = false;
+    compression packing = compression::none;
+    list_style style = list_style::text;
+    std::optional<archive_cache> cache;
 
     while ((opt = getopt_long(argc, argv, opts, longopts, nullptr)) >= 0) {
         switch (opt)
@@ -910,6 +1263,9 @@ int main(int argc, char **argv)
         case 'x': action = run_action::extract;  break;
         case 't': action = run_action::list;    break;
         case 'c': action = run_action::create;   break;
+        case 'r': action = run_action::replace;  break;
+        case 'q': action = run_action::append;   break;
+        case 'S': action = run_action::scan;     break;
 
         case 'i':
         case 'f':
@@ -930,16 +1286,122 @@ int main(int argc, char **argv)
                     switch (opt)
                     {
                     case 'i':
-                        detect = f->second.first;
+                        detect = f->second.detect;
+                        forced_input = true;
                         break;
                     case 'f':
-                        construct = f->second.second;
+                        target = &f->second;
                         break;
                     }
                 }
             }
             break;
 
+        case 'j':
+            if (auto n = parse_count(optarg)) {
+                threads = *n;
+                threads_given = true;
+            } else {
+                std::cerr << "invalid number of jobs: '" << optarg << "'"
+                          << std::endl;
+                usage(std::cerr);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'b':
+            if (auto n = parse_count(optarg)) {
+                buffer = *n;
+            } else {
+                std::cerr << "invalid buffer size: '" << optarg << "'"
+                          << std::endl;
+                usage(std::cerr);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'd':
+            dedupe = true;
+            break;
+
+        case 'k':
+            cache.emplace(optarg);
+            break;
+
+        case 'D':
+            deterministic = true;
+            break;
+
+        case 's':
+            {
+                std::string_view o { optarg };
+                index_given = true;
+                if (o == "gnu") {
+                    options.index = symbol_index::gnu;
+                } else if (o == "bsd") {
+                    options.index = symbol_index::bsd;
+                } else if (o == "none") {
+                    options.index = symbol_index::none;
+                } else {
+                    std::cerr << "invalid symbol index: '" << o << "'"
+                              << std::endl;
+                    return EXIT_FAILURE;
+                }
+            }
+            break;
+
+        case 'l':
+            {
+                std::string_view o { optarg };
+                if (o == "text") {
+                    style = list_style::text;
+                } else if (o == "json") {
+                    style = list_style::json;
+                } else if (o == "ndjson") {
+                    style = list_style::ndjson;
+                } else if (o == "tsv") {
+                    style = list_style::tsv;
+                } else {
+                    std::cerr << "invalid listing format: '" << o << "'"
+                              << std::endl;
+                    return EXIT_FAILURE;
+                }
+            }
+            break;
+
+        case 'z':
+            {
+                std::string_view o { optarg };
+                if (o == "zstd") {
+                    packing = compression::zstd;
+                } else if (o == "gzip") {
+                    packing = compression::gzip;
+                } else if (o == "none") {
+                    packing = compression::none;
+                } else {
+                    std::cerr << "invalid compression: '" << o << "'"
+                              << std::endl;
+                    return EXIT_FAILURE;
+                }
+            }
+            break;
+
+        case 'n':
+            {
+                std::string_view o { optarg };
+                names_given = true;
+                if (o == "gnu") {
+                    options.names = long_names::gnu;
+                } else if (o == "bsd") {
+                    options.names = long_names::bsd;
+                } else {
+                    std::cerr << "invalid long name style: '" << o << "'"
+                              << std::endl;
+                    return EXIT_FAILURE;
+                }
+            }
+            break;
+
         case 'h':
             help(std::cout);
             return EXIT_SUCCESS;
@@ -960,6 +1422,61 @@ int main(int argc, char **argv)
         operands.emplace_back(argv[optind++]);
     }
 
+    // like ar(1), updating an archive that isn't there yet creates it
+    if (((action == run_action::replace) || (action == run_action::append))
+            && !input.empty() && !fs::exists(input))
+        action = run_action::create;
+
+    /* archives we can't map or seek around in get walked front to back as
+     * they arrive, unless the format was forced (which needs the whole thing
+     * in hand to check) */
+    std::optional<std::ifstream> stream_file;
+    std::istream* stream = nullptr;
+    if (!forced_input && ((action == run_action::convert)
+                || (action == run_action::list)
+                || (action == run_action::extract))
+            && is_stream_input(input)) {
+        if (input == "-") {
+            stream = &std::cin;
+        } else {
+            stream_file.emplace(input, std::ios::in | std::ios::binary);
+            if (!*stream_file) {
+                std::cerr << "Couldn't open " << input << std::endl;
+                return EXIT_FAILURE;
+            }
+            stream = &*stream_file;
+        }
+    }
+    if (auto dir = getenv("EXAR_CACHE"); !cache && dir && *dir)
+        cache.emplace(dir);
+    /* only what was detected from scratch gets cached, or looked up: a
+     * forced format may well read the same bytes differently */
+    auto open_detected = [&](bool content) {
+        // parsers reject what they can't read with a bare exception
+        try {
+            if (cache && !forced_input)
+                return cache->open(input, detect, content);
+            return detect(open_archive(input));
+        } catch (std::system_error&) {
+            throw;
+        } catch (std::exception&) {
+            throw std::system_error { EBADMSG, std::generic_category(),
+                                      "malformed archive" };
+        }
+    };
+
+    // and if they're compressed, unpacked on the way
+    std::optional<decoding_buf> unpacked;
+    std::optional<std::istream> unpacked_stream;
+    if (stream) {
+        unpacked.emplace(*stream);
+        unpacked_stream.emplace(&*unpacked);
+        /* istream turns errors from the buffer into badbit, which readers
+         * would take for the end of the input; this rethrows them instead */
+        unpacked_stream->exceptions(std::ios::badbit);
+        stream = &*unpacked_stream;
+    }
+
     switch (action)
     {
     case run_action::none:
@@ -970,12 +1487,74 @@ int main(int argc, char **argv)
         if (operands.size() > 1) {
             std::cerr << "Too many operand files specified." << std::endl;
             return EXIT_FAILURE;
+        } else if (operands.empty()) {
+            std::cerr << "No output file specified." << std::endl;
+            return EXIT_FAILURE;
+        } else if (stream && !target->append) {
+            std::cerr << "Can't convert a stream to that format." << std::endl;
+            return EXIT_FAILURE;
+        } else if (stream && dedupe) {
+            std::cerr << "Can't look for duplicates in a stream." << std::endl;
+            return EXIT_FAILURE;
+        } else if (std::error_code ec; !stream && (operands[0] != "-")
+                && fs::equivalent(input, operands[0], ec)) {
+            std::cerr << "Refusing to convert an archive onto itself."
+                      << std::endl;
+            return EXIT_FAILURE;
         }
         {
-            shared_istream i = std::make_shared<std::ifstream>(input);
-            std::ofstream o { operands[0] };
-            auto archive = detect(i);
-            construct(o, archive);
+            /* the input is recognized before the output is touched, so that
+             * getting it wrong doesn't cost us whatever was there */
+            std::optional<stream_reader> reader;
+            shared_archive archive;
+            try {
+                if (stream) {
+                    reader.emplace(*stream);
+                } else {
+                    archive = open_detected(true);
+                    if (dedupe) {
+                        options.originals = find_duplicates(archive, threads);
+                        report_duplicates(archive, options);
+                    }
+                }
+            } catch (std::system_error& exc) {
+                std::cerr << "While converting " << input
+                          << ", encountered an error: " << exc.what()
+                          << std::endl;
+                return EXIT_FAILURE;
+            }
+            try {
+                // writing is strictly front to back, so stdout works fine
+                auto o = (operands[0] == "-")
+                    ? std::make_unique<output>(STDOUT_FILENO, buffer)
+                    : std::make_unique<output>(fs::path { operands[0] }, 0666,
+                                               buffer);
+                if (auto dir = fs::path { operands[0] }.parent_path();
+                        !dir.empty() && (operands[0] != "-"))
+                    options.base = dir;
+                if (packing != compression::none)
+                    o->compress(packing, threads_given ? threads : 0);
+                if (stream) {
+                    /* nothing is known about the members until they've gone by,
+                     * so there's no symbol index; they're just copied across */
+                    target->start(*o);
+                    reader->each([&](const entry& e) {
+                        if (!format_files.contains(e.name))
+                            target->append(e, *o);
+                    });
+                } else {
+                    target->construct(*o, archive, options);
+                }
+                o->flush();
+            } catch (std::system_error& exc) {
+                // don't leave half an archive lying around
+                std::cerr << "While converting " << input
+                          << ", encountered an error: " << exc.what()
+                          << std::endl;
+                if (operands[0] != "-")
+                    fs::remove(operands[0]);
+                return EXIT_FAILURE;
+            }
         }
         return EXIT_SUCCESS;
 
@@ -984,10 +1563,14 @@ int main(int argc, char **argv)
             std::cerr << "Too many operand files specified." << std::endl;
             return EXIT_FAILURE;
         }
-        {
-            shared_istream f = std::make_shared<std::ifstream>(input);
-            auto archive = detect(f);
+        try {
+            auto archive = open_detected(false);
             std::cout << archive->description() << std::endl;
+        } catch (std::system_error& exc) {
+            std::cerr << "While identifying " << input
+                      << ", encountered an error: " << exc.what()
+                      << std::endl;
+            return EXIT_FAILURE;
         }
         return EXIT_SUCCESS;
 
@@ -996,19 +1579,156 @@ int main(int argc, char **argv)
             std::cerr << "Too many operand files specified." << std::endl;
             return EXIT_FAILURE;
         }
-        {
-            shared_istream f = std::make_shared<std::ifstream>(input);
-            auto archive = detect(f);
-            for (auto& e : archive->get_members()) {
-                std::cout << e.name << std::endl;
+        try {
+            output o { STDOUT_FILENO };
+            lister list { o, style };
+            if (stream) {
+                stream_reader reader { *stream };
+                reader.each([&](const entry& e) {
+                    if (!format_files.contains(e.name))
+                        list.add(e);
+                });
+            } else {
+                auto archive = open_detected(false);
+                for (auto e : archive->get_members())
+                    list.add(e);
             }
+            list.finish();
+        } catch (std::system_error& exc) {
+            std::cerr << "While listing " << input
+                      << ", encountered an error: " << exc.what()
+                      << std::endl;
+            return EXIT_FAILURE;
         }
         return EXIT_SUCCESS;
 
     case run_action::extract:
-        std::cerr << "FIXME: archive extraction is currently not implemented!"
-                  << std::endl;
-        return EXIT_FAILURE;
+        if (stream) {
+            /* members are written out as they go by; later ones with the same
+             * name simply overwrite earlier ones */
+            std::set<std::string_view> wanted { operands.begin(),
+                                                operands.end() };
+            std::set<std::string> found;
+            int status = EXIT_SUCCESS;
+            try {
+                stream_reader reader { *stream };
+                reader.each([&](const entry& e) {
+                    if (format_files.contains(e.name))
+                        return;
+                    if (!wanted.empty() && !wanted.contains(e.name))
+                        return;
+                    found.emplace(e.name);
+                    auto path = fs::path { e.name }.filename();
+                    if (path.empty() || (path == ".") || (path == "..")) {
+                        std::cerr << "Skipping member with unusable name: '"
+                                  << e.name << "'" << std::endl;
+                        status = EXIT_FAILURE;
+                        return;
+                    }
+                    try {
+                        output o { path, (mode_t)((e.mode & 0777) ?: 0644) };
+                        e.copy_content_to(o);
+                        o.flush();
+                    } catch (std::exception& exc) {
+                        std::cerr << "While extracting " << path
+                                  << ", encountered an error: " << exc.what()
+                                  << std::endl;
+                        status = EXIT_FAILURE;
+                    }
+                });
+            } catch (std::system_error& exc) {
+                std::cerr << "While extracting " << input
+                          << ", encountered an error: " << exc.what()
+                          << std::endl;
+                return EXIT_FAILURE;
+            }
+            for (auto& name : wanted) {
+                if (!found.contains(std::string { name })) {
+                    std::cerr << "No such member in " << input << ": "
+                              << name << std::endl;
+                    status = EXIT_FAILURE;
+                }
+            }
+            return status;
+        }
+        {
+            shared_archive archive;
+            try {
+                archive = open_detected(true);
+            } catch (std::system_error& exc) {
+                std::cerr << "While extracting " << input
+                          << ", encountered an error: " << exc.what()
+                          << std::endl;
+                return EXIT_FAILURE;
+            }
+            std::vector<entry> selected;
+            int status = EXIT_SUCCESS;
+            if (operands.empty()) {
+                for (auto e : archive->get_members())
+                    selected.push_back(e);
+            }
+            for (auto& name : operands) {
+                if (auto e = archive->find_member(name)) {
+                    selected.push_back(*e);
+                } else {
+                    std::cerr << "No such member in " << input << ": "
+                              << name << std::endl;
+                    status = EXIT_FAILURE;
+                }
+            }
+            /* work out where everything goes up front; if several members
+             * land on the same path, the last one wins, just like ar(1) */
+            std::vector<std::pair<fs::path, entry>> jobs;
+            std::map<fs::path, size_t> seen;
+            for (auto& e : selected) {
+                // never let a member name escape the current directory
+                auto path = fs::path { e.name }.filename();
+                if (path.empty() || (path == ".") || (path == "..")) {
+                    std::cerr << "Skipping member with unusable name: '"
+                              << e.name << "'" << std::endl;
+                    status = EXIT_FAILURE;
+                    continue;
+                }
+                auto [it, added] = seen.emplace(path, jobs.size());
+                if (added)
+                    jobs.emplace_back(path, e);
+                else
+                    jobs[it->second].second = e;
+            }
+            /* members are independent views into the shared input, so each
+             * worker can preallocate and fill its own output file without
+             * any shared stream position */
+            std::vector<std::string> errors(jobs.size());
+            auto extract = [&](size_t i) {
+                auto& [path, e] = jobs[i];
+                try {
+                    output o { path, (mode_t)((e.mode & 0777) ?: 0644) };
+                    o.reserve(e.content_size);
+                    e.copy_content_to(o);
+                    o.flush();
+                } catch (std::exception& exc) {
+                    errors[i] = exc.what();
+                }
+            };
+            if (threads == 1) {
+                for (size_t i = 0; i < jobs.size(); ++i)
+                    extract(i);
+            } else {
+                thread_pool pool { threads };
+                for (size_t i = 0; i < jobs.size(); ++i)
+                    pool.submit([&extract, i] { extract(i); });
+                pool.wait();
+            }
+            for (size_t i = 0; i < jobs.size(); ++i) {
+                if (errors[i].size()) {
+                    std::cerr << "While extracting " << jobs[i].first
+                              << ", encountered an error: " << errors[i]
+                              << std::endl;
+                    status = EXIT_FAILURE;
+                }
+            }
+            return status;
+        }
 
     case run_action::create:
         if (operands.size() == 0) {
@@ -1016,9 +1736,137 @@ int main(int argc, char **argv)
                       << std::endl;
             return EXIT_FAILURE;
         }
-        std::cerr << "FIXME: archive creation is currently not implemented!"
-                  << std::endl;
-        return EXIT_FAILURE;
+        {
+            /* everything is looked at before the output is touched, so a
+             * missing file doesn't cost us an existing archive */
+            shared_archive files;
+            try {
+                files = std::make_shared<file_list>(operands, threads,
+                        target == &formats.at("thin"), deterministic);
+            } catch (std::system_error& exc) {
+                std::cerr << "Couldn't add " << exc.what() << std::endl;
+                return EXIT_FAILURE;
+            }
+            if (dedupe) {
+                options.originals = find_duplicates(files, threads);
+                report_duplicates(files, options);
+            }
+            try {
+                auto o = (input == "-")
+                    ? std::make_unique<output>(STDOUT_FILENO, buffer)
+                    : std::make_unique<output>(fs::path { input }, 0666,
+                                               buffer);
+                if (auto dir = fs::path { input }.parent_path();
+                        !dir.empty() && (input != "-"))
+                    options.base = dir;
+                if (packing != compression::none)
+                    o->compress(packing, threads_given ? threads : 0);
+                target->construct(*o, files, options);
+                o->flush();
+            } catch (std::system_error& exc) {
+                std::cerr << "While creating " << input
+                          << ", encountered an error: " << exc.what()
+                          << std::endl;
+                if (input != "-")
+                    fs::remove(input);
+                return EXIT_FAILURE;
+            }
+        }
+        return EXIT_SUCCESS;
+
+    case run_action::replace:
+    case run_action::append:
+        if (operands.size() == 0) {
+            std::cerr << "No files specified." << std::endl;
+            return EXIT_FAILURE;
+        } else if (is_stream_input(input)) {
+            std::cerr << "Can only update regular files." << std::endl;
+            return EXIT_FAILURE;
+        }
+        {
+            /* the archive keeps its format, and gets written over itself:
+             * only what changed and whatever comes after it is written */
+            shared_input old;
+            detection found;
+            try {
+                old = open_input(input);
+                found = identify_format(old);
+            } catch (std::system_error& exc) {
+                std::cerr << "Couldn't open " << exc.what() << std::endl;
+                return EXIT_FAILURE;
+            }
+            if (detect_compression(old->view(0, 4)) != compression::none) {
+                std::cerr << "Can't update a compressed archive in place."
+                          << std::endl;
+                return EXIT_FAILURE;
+            } else if (!found) {
+                std::cerr << "Unrecognized archive format: " << input
+                          << std::endl;
+                return EXIT_FAILURE;
+            }
+            keep_style(found.archive, options, index_given, names_given);
+            shared_archive files;
+            try {
+                files = std::make_shared<file_list>(found.archive, operands,
+                        threads, action == run_action::replace,
+                        found.format == "thin", deterministic);
+            } catch (std::system_error& exc) {
+                std::cerr << "Couldn't add " << exc.what() << std::endl;
+                return EXIT_FAILURE;
+            }
+            if (dedupe) {
+                options.originals = find_duplicates(files, threads);
+                report_duplicates(files, options);
+            }
+            if (auto dir = fs::path { input }.parent_path(); !dir.empty())
+                options.base = dir;
+            int fd = ::open(input.c_str(), O_RDWR | O_CLOEXEC);
+            try {
+                if (fd < 0)
+                    throw std::system_error { errno, std::generic_category(),
+                                              input };
+                output o { fd, old, buffer };
+                formats.at(found.format).construct(o, files, options);
+                o.finish();
+            } catch (std::system_error& exc) {
+                std::cerr << "While updating " << input
+                          << ", encountered an error: " << exc.what()
+                          << std::endl;
+                if (fd >= 0)
+                    ::close(fd);
+                return EXIT_FAILURE;
+            }
+            ::close(fd);
+        }
+        return EXIT_SUCCESS;
+
+    case run_action::scan:
+        if (input.empty()) {
+            std::cerr << "No directory to scan." << std::endl;
+            return EXIT_FAILURE;
+        } else if (operands.size() > 0) {
+            std::cerr << "Too many operand files specified." << std::endl;
+            return EXIT_FAILURE;
+        }
+        {
+            std::error_code ec;
+            auto type = fs::status(input, ec).type();
+            if ((type != fs::file_type::directory)
+                    && (type != fs::file_type::regular)) {
+                std::cerr << "Can't scan " << input << ": "
+                          << (ec ? ec.message() : "not a directory")
+                          << std::endl;
+                return EXIT_FAILURE;
+            }
+            thread_pool pool { threads_given ? threads : 0 };
+            census found { pool, std::cout };
+            if (type == fs::file_type::directory)
+                found.walk(input);
+            else
+                found.check(input);
+            pool.wait();
+            return found.ok() ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
     }
 }
 
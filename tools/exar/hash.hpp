@@ -0,0 +1,114 @@
+/* This file is part of Polyglot.
+
+  Copyright (C) 2024, Battelle Energy Alliance, LLC ALL RIGHTS RESERVED
+
+  Polyglot is free software; you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation; either version 3, or (at your option) any later version.
+
+  Polyglot is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  this software; if not see <http://www.gnu.org/licenses/>. */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+#include "endian.hpp"
+
+/*
+ * XXH64, as specified at https://github.com/Cyan4973/xxHash/blob/dev/doc/
+ * xxhash_spec.md. It's a fast non-cryptographic hash, which is all we need to
+ * find members that are probably identical; anything it says matches still
+ * gets compared in full before being treated as a duplicate.
+ */
+
+namespace xxh64 {
+
+static constexpr uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+static constexpr uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+static constexpr uint64_t prime3 = 0x165667B19E3779F9ULL;
+static constexpr uint64_t prime4 = 0x85EBCA77C2B2AE63ULL;
+static constexpr uint64_t prime5 = 0x27D4EB2F165667C5ULL;
+
+namespace detail {
+
+constexpr uint64_t rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+/* the input is defined as little endian, whatever the host is */
+template <class T>
+T read(const std::byte* p)
+{
+    T value;
+    memcpy(&value, p, sizeof(value));
+    return swap_endian<endian::little>(value);
+}
+
+constexpr uint64_t round(uint64_t acc, uint64_t lane)
+{
+    acc += lane * prime2;
+    acc = rotl(acc, 31);
+    return acc * prime1;
+}
+
+constexpr uint64_t merge(uint64_t acc, uint64_t value)
+{
+    acc ^= round(0, value);
+    return acc * prime1 + prime4;
+}
+
+} // ::detail
+
+inline uint64_t hash(std::span<const std::byte> data, uint64_t seed = 0)
+{
+    using namespace detail;
+    auto p = data.data();
+    auto end = p + data.size();
+    uint64_t acc;
+
+    if (data.size() >= 32) {
+        // four lanes of 8 bytes at a time
+        uint64_t v[4] = { seed + prime1 + prime2, seed + prime2, seed,
+                          seed - prime1 };
+        for (; p + 32 <= end; p += 32) {
+            for (int i = 0; i < 4; ++i)
+                v[i] = round(v[i], read<uint64_t>(p + i * 8));
+        }
+        acc = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18);
+        for (int i = 0; i < 4; ++i)
+            acc = merge(acc, v[i]);
+    } else {
+        acc = seed + prime5;
+    }
+    acc += data.size();
+
+    // whatever's left over, in 8, 4 and 1 byte pieces
+    for (; p + 8 <= end; p += 8)
+        acc = rotl(acc ^ round(0, read<uint64_t>(p)), 27) * prime1 + prime4;
+    if (p + 4 <= end) {
+        acc ^= read<uint32_t>(p) * prime1;
+        acc = rotl(acc, 23) * prime2 + prime3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        acc ^= std::to_integer<uint8_t>(*p) * prime5;
+        acc = rotl(acc, 11) * prime1;
+    }
+
+    // final avalanche
+    acc ^= acc >> 33;
+    acc *= prime2;
+    acc ^= acc >> 29;
+    acc *= prime3;
+    acc ^= acc >> 32;
+    return acc;
+}
+
+} // ::xxh64
@@ -0,0 +1,163 @@
+/* This file is part of Polyglot.
+
+  Copyright (C) 2024, Battelle Energy Alliance, LLC ALL RIGHTS RESERVED
+
+  Polyglot is free software; you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation; either version 3, or (at your option) any later version.
+
+  Polyglot is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  this software; if not see <http://www.gnu.org/licenses/>. */
+
+#include "archive.hpp"
+#include "libexar.hpp"
+
+/*
+ * The library is built with everything hidden but what libexar.hpp marks for
+ * export, so none of exar's own classes can clash with a program's.
+ */
+
+namespace exar {
+
+struct archive::state
+{
+    shared_input input;
+    const probe_entry* format;
+};
+
+std::vector<std::string_view> formats()
+{
+    std::vector<std::string_view> names;
+    for (auto& p : probes)
+        names.push_back(p.format);
+    return names;
+}
+
+/*
+ * Only the magic is looked at when it leaves no doubt, which it does for
+ * anything but the old 16-bit formats; those get their headers walked (but
+ * not parsed into anything) to tell them apart.
+ */
+archive::archive(const std::filesystem::path& path)
+{
+    auto s = std::make_shared<state>();
+    s->input = open_archive(path);
+    auto& in = *s->input;
+    auto head = in.view(0, 8);
+    std::string_view magic { (const char*)head.data(), head.size() };
+    const probe_entry* winner = nullptr;
+    size_t candidates = 0, best = 0;
+
+    for (auto& p : probes) {
+        if (magic.starts_with(p.magic)) {
+            ++candidates;
+            winner = winner ? winner : &p;
+        }
+    }
+    if (candidates > 1) {
+        winner = nullptr;
+        for (auto& p : probes) {
+            if (!magic.starts_with(p.magic))
+                continue;
+            if (auto score = p.probe(in); score > best) {
+                best = score;
+                winner = &p;
+            }
+        }
+    }
+    if (!winner)
+        throw std::system_error { EINVAL, std::generic_category(),
+                                  path.string() };
+    s->format = winner;
+    _state = s;
+}
+
+std::string_view archive::format() const
+{
+    return _state->format->format;
+}
+
+std::span<const std::byte> archive::data() const
+{
+    return _state->input->data();
+}
+
+archive::iterator archive::begin() const
+{
+    return iterator { _state };
+}
+
+archive::iterator::iterator(std::shared_ptr<const state> state)
+    : _state { std::move(state) }
+    , _pos { _state->format->magic.size() }
+    , _done { false }
+{
+    advance();
+}
+
+/* parse headers up to the next real member, or the end */
+void archive::iterator::advance()
+{
+    auto& in = *_state->input;
+    auto& fmt = *_state->format;
+
+    for (;;) {
+        // a partial header at the end is ignored, just like exar does
+        if (_pos + fmt.header_size > in.size()) {
+            _done = true;
+            _member = {};
+            return;
+        }
+        entry ent {};
+        try {
+            ent.input = &in;
+            ent.header_offset = _pos;
+            fmt.decode(in.view(_pos, fmt.header_size), ent);
+            if (!ent.name.size() || (ent.name.at(0) == 0))
+                throw std::exception {};
+            ent.content_offset = _pos + fmt.header_size;
+            _pos = ent.content_offset;
+            if (fmt.stored(ent)) {
+                if (ent.content_size > in.size() - _pos)
+                    throw std::exception {};
+                _pos += align(ent.content_size, fmt.alignment);
+            }
+            fmt.resolve(ent, _names);
+        } catch (std::system_error&) {
+            throw;
+        } catch (std::exception&) {
+            throw std::system_error { EBADMSG, std::generic_category(),
+                                      "malformed header" };
+        }
+
+        /* names from the GNU table were found in our copy of it, but they
+         * have to last as long as the archive does, so point them into the
+         * archive instead */
+        if (ent.name == common::current::gnu_names)
+            _table = ent.content();
+        auto copy = std::string_view { _names };
+        if (!copy.empty() && (ent.name.data() >= copy.data())
+                && (ent.name.data() < copy.data() + copy.size())) {
+            auto offset = ent.name.data() - copy.data();
+            ent.name = { (const char*)_table.data() + offset,
+                         ent.name.size() };
+            if (!ent.external.empty())
+                ent.external = ent.name;
+        }
+        if (format_files.contains(ent.name))
+            continue;
+
+        _member = { ent.name, ent.header_offset, ent.content_offset,
+                    ent.content_size, ent.date, ent.uid, ent.gid, ent.mode,
+                    ent.external, {} };
+        if (ent.external.empty())
+            _member.content = ent.content();
+        return;
+    }
+}
+
+} // ::exar
@@ -0,0 +1,144 @@
+/* This file is part of Polyglot.
+
+  Copyright (C) 2024, Battelle Energy Alliance, LLC ALL RIGHTS RESERVED
+
+  Polyglot is free software; you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation; either version 3, or (at your option) any later version.
+
+  Polyglot is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  this software; if not see <http://www.gnu.org/licenses/>. */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <iterator>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * libexar: reading archives in every format exar knows, from within another
+ * program. An archive is mapped (or decompressed, if it has to be) when it's
+ * opened, but its headers are only parsed as iteration gets to them, so
+ * looking at the first few members of a huge archive costs next to nothing.
+ *
+ *     for (auto& m : exar::archive { path })
+ *         index(m.name, m.content);
+ *
+ * Anything that goes wrong throws std::system_error: EINVAL for a file that
+ * isn't an archive we know, EBADMSG for a header that doesn't parse.
+ */
+
+#define EXAR_API __attribute__((visibility("default")))
+
+namespace exar {
+
+/* one member, which is only good for as long as its archive is around */
+struct member
+{
+    std::string_view name;
+    uint64_t header_offset;
+    // where the content starts in the (uncompressed) archive, and its size
+    uint64_t offset;
+    uint64_t size;
+    uint64_t date;
+    unsigned uid;
+    unsigned gid;
+    unsigned mode;
+    // members of thin archives: the file holding the content (which is
+    // then empty), relative to wherever the archive is
+    std::string_view external;
+    std::span<const std::byte> content;
+};
+
+/* names of the formats archives can be in, as `format()` gives them */
+EXAR_API std::vector<std::string_view> formats();
+
+class EXAR_API archive
+{
+    struct state;
+    std::shared_ptr<const state> _state;
+
+public:
+    class iterator;
+    struct sentinel {};
+
+    explicit archive(const std::filesystem::path& path);
+
+    /* "current", "thin", "old:little" and so on */
+    std::string_view format() const;
+
+    /* the whole archive (after decompression, if it was compressed) */
+    std::span<const std::byte> data() const;
+
+    iterator begin() const;
+    sentinel end() const
+    {
+        return {};
+    }
+};
+
+/*
+ * Walks the members of an archive, parsing each header when it's reached.
+ * Copies carry on from the same place, each on their own.
+ */
+class EXAR_API archive::iterator
+{
+    std::shared_ptr<const state> _state;
+    // the next header, and the GNU name table (once there's been one)
+    uint64_t _pos = 0;
+    std::string _names;
+    std::span<const std::byte> _table;
+    member _member {};
+    bool _done = true;
+
+    friend class archive;
+    explicit iterator(std::shared_ptr<const state> state);
+    void advance();
+
+public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = member;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const member*;
+    using reference = const member&;
+
+    iterator() = default;
+
+    const member& operator*() const
+    {
+        return _member;
+    }
+
+    const member* operator->() const
+    {
+        return &_member;
+    }
+
+    iterator& operator++()
+    {
+        advance();
+        return *this;
+    }
+
+    void operator++(int)
+    {
+        advance();
+    }
+
+    bool operator==(sentinel) const
+    {
+        return _done;
+    }
+};
+
+} // ::exar
@@ -0,0 +1,153 @@
+/* This file is part of Polyglot.
+
+  Copyright (C) 2024, Battelle Energy Alliance, LLC ALL RIGHTS RESERVED
+
+  Polyglot is free software; you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation; either version 3, or (at your option) any later version.
+
+  Polyglot is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  this software; if not see <http://www.gnu.org/licenses/>. */
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * A small work-stealing thread pool. Every worker owns a deque of tasks; it
+ * pops work off the back of its own deque, and when that runs dry it steals
+ * from the front of everybody else's. Tasks are dealt out round-robin as they
+ * are submitted, so a batch of uneven jobs (one huge archive among thousands
+ * of tiny ones) still ends up spread across every worker.
+ */
+class thread_pool
+{
+    using task = std::function<void()>;
+
+    struct queue
+    {
+        std::mutex lock;
+        std::deque<task> tasks;
+    };
+
+    std::vector<std::unique_ptr<queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> next { 0 };
+    std::atomic<size_t> queued { 0 };
+    size_t pending = 0;
+    std::mutex idle_lock;
+    std::condition_variable idle;
+    std::condition_variable done;
+    bool stopping = false;
+
+public:
+    explicit thread_pool(size_t count = 0)
+    {
+        if (!count)
+            count = std::max(1u, std::thread::hardware_concurrency());
+        for (size_t i = 0; i < count; ++i)
+            queues.emplace_back(std::make_unique<queue>());
+        for (size_t i = 0; i < count; ++i)
+            workers.emplace_back([this, i] { run(i); });
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    ~thread_pool()
+    {
+        {
+            std::lock_guard guard { idle_lock };
+            stopping = true;
+        }
+        idle.notify_all();
+        for (auto& t : workers)
+            t.join();
+    }
+
+    size_t size() const
+    {
+        return workers.size();
+    }
+
+    void submit(task t)
+    {
+        auto& q = *queues[next++ % queues.size()];
+        {
+            std::lock_guard guard { idle_lock };
+            ++pending;
+            ++queued;
+        }
+        {
+            std::lock_guard guard { q.lock };
+            q.tasks.push_back(std::move(t));
+        }
+        idle.notify_one();
+    }
+
+    /* block until every submitted task has finished */
+    void wait()
+    {
+        std::unique_lock guard { idle_lock };
+        done.wait(guard, [this] { return pending == 0; });
+    }
+
+private:
+    bool pop(size_t self, task& t)
+    {
+        // our own work first, newest first...
+        {
+            auto& q = *queues[self];
+            std::lock_guard guard { q.lock };
+            if (!q.tasks.empty()) {
+                t = std::move(q.tasks.back());
+                q.tasks.pop_back();
+                --queued;
+                return true;
+            }
+        }
+        // ...then steal the oldest work from everybody else
+        for (size_t i = 1; i < queues.size(); ++i) {
+            auto& q = *queues[(self + i) % queues.size()];
+            std::lock_guard guard { q.lock };
+            if (!q.tasks.empty()) {
+                t = std::move(q.tasks.front());
+                q.tasks.pop_front();
+                --queued;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(size_t self)
+    {
+        task t;
+        for (;;) {
+            if (pop(self, t)) {
+                // tasks are expected to report their own errors
+                try {
+                    t();
+                } catch (...) {}
+                t = nullptr;
+                std::lock_guard guard { idle_lock };
+                if (--pending == 0)
+                    done.notify_all();
+                continue;
+            }
+            std::unique_lock guard { idle_lock };
+            idle.wait(guard, [this] { return stopping || queued; });
+            if (stopping && !queued)
+                return;
+        }
+    }
+};
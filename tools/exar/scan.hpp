@@ -0,0 +1,262 @@
+/* This file is part of Polyglot.
+
+  Copyright (C) 2024, Battelle Energy Alliance, LLC ALL RIGHTS RESERVED
+
+  Polyglot is free software; you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation; either version 3, or (at your option) any later version.
+
+  Polyglot is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  this software; if not see <http://www.gnu.org/licenses/>. */
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define use_x86_scan 1
+#include <immintrin.h>
+#else
+#define use_x86_scan 0
+#endif
+
+/*
+ * Batch scanner for the member chain of a current format archive. Finding
+ * where each member lives only needs two things out of every `ar_hdr`: that
+ * `ar_fmag` is intact, and the decimal value of `ar_size`. Those both sit in
+ * the last 16 bytes of the header, so they can be checked and converted with
+ * a handful of vector instructions rather than byte at a time.
+ *
+ * Every kernel must agree exactly with the scalar one, which in turn matches
+ * how `field_parser` reads the field: the digits run up to the first space
+ * (or the end of the field), there has to be at least one, and anything after
+ * that space is ignored.
+ */
+
+namespace common {
+
+namespace current {
+
+namespace scan {
+
+/* parse one header; false if it's malformed */
+using kernel = bool (*)(const char* hdr, uint64_t& size);
+
+static constexpr size_t size_offset = offsetof(ar_hdr, ar_size);
+static constexpr size_t size_length = sizeof(ar_hdr::ar_size);
+static constexpr size_t fmag_offset = offsetof(ar_hdr, ar_fmag);
+
+inline bool scalar(const char* hdr, uint64_t& size)
+{
+    if ((hdr[fmag_offset] != fmag[0]) || (hdr[fmag_offset + 1] != fmag[1]))
+        return false;
+    uint64_t value = 0;
+    size_t i = 0;
+    for (; (i < size_length) && (hdr[size_offset + i] != ' '); ++i) {
+        char c = hdr[size_offset + i];
+        if ((c < '0') || (c > '9'))
+            return false;
+        value = value * 10 + (c - '0');
+    }
+    if (!i)
+        return false;
+    size = value;
+    return true;
+}
+
+#if use_x86_scan
+
+/* the last 16 bytes of the header: the tail of ar_mode, ar_size, ar_fmag */
+static constexpr size_t tail_offset = sizeof(ar_hdr) - 16;
+static constexpr size_t lane = size_offset - tail_offset;
+
+static_assert(fmag_offset + 2 == sizeof(ar_hdr));
+static_assert(lane + size_length + 2 == 16);
+
+/* figure out how many digits the size field has, or 0 if it's bad */
+inline unsigned digit_count(unsigned spaces, unsigned digits)
+{
+    constexpr unsigned field = (1u << size_length) - 1;
+    spaces = (spaces >> lane) & field;
+    digits = (digits >> lane) & field;
+    unsigned len = __builtin_ctz(spaces | (1u << size_length));
+    unsigned want = (1u << len) - 1;
+    return (len && ((digits & want) == want)) ? len : 0;
+}
+
+/*
+ * SSE2: weight every lane by its power of ten with pmaddwd. Powers above
+ * 10^4 don't fit in a 16-bit weight, so the digits are summed in two groups
+ * (exponents 0-4 and 5-9) that get combined at the end.
+ */
+struct sse2_weights
+{
+    alignas(16) int16_t lo[size_length + 1][16];
+    alignas(16) int16_t hi[size_length + 1][16];
+};
+
+static constexpr sse2_weights make_sse2_weights()
+{
+    sse2_weights w {};
+    for (size_t len = 1; len <= size_length; ++len) {
+        for (size_t i = 0; i < len; ++i) {
+            size_t e = len - 1 - i;
+            int16_t p = 1;
+            for (size_t k = 0; k < e % 5; ++k)
+                p *= 10;
+            (e < 5 ? w.lo : w.hi)[len][lane + i] = p;
+        }
+    }
+    return w;
+}
+
+static constexpr sse2_weights weights = make_sse2_weights();
+
+__attribute__((target("sse2")))
+inline uint32_t sse2_sum(__m128i d, const int16_t* w)
+{
+    auto zero = _mm_setzero_si128();
+    auto a = _mm_madd_epi16(_mm_unpacklo_epi8(d, zero),
+                            _mm_load_si128((const __m128i*)w));
+    auto b = _mm_madd_epi16(_mm_unpackhi_epi8(d, zero),
+                            _mm_load_si128((const __m128i*)(w + 8)));
+    auto s = _mm_add_epi32(a, b);
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(s);
+}
+
+__attribute__((target("sse2")))
+inline bool sse2(const char* hdr, uint64_t& size)
+{
+    auto v = _mm_loadu_si128((const __m128i*)(hdr + tail_offset));
+    auto fmag_want = _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0,
+                                   0, 0, 0, 0, 0, 0, fmag[0], fmag[1]);
+    if ((_mm_movemask_epi8(_mm_cmpeq_epi8(v, fmag_want)) & 0xc000) != 0xc000)
+        return false;
+    auto spaces = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+    auto digits = _mm_movemask_epi8(_mm_and_si128(
+        _mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+        _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1))));
+    auto len = digit_count(spaces, digits);
+    if (!len)
+        return false;
+    // lanes outside the digits have zero weight, so garbage there is fine
+    auto d = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+    size = (uint64_t)sse2_sum(d, weights.hi[len]) * 100000
+         + sse2_sum(d, weights.lo[len]);
+    return true;
+}
+
+/*
+ * AVX2 (which brings SSSE3/SSE4.1 along with it): shuffle the digits so
+ * they're right-aligned in the register with zeros ahead of them, then fold
+ * adjacent lanes together (x10, x100, x10000) the usual way.
+ */
+struct avx2_shuffles
+{
+    alignas(16) int8_t align[size_length + 1][16];
+};
+
+static constexpr avx2_shuffles make_avx2_shuffles()
+{
+    avx2_shuffles s {};
+    for (size_t len = 0; len <= size_length; ++len) {
+        for (size_t j = 0; j < 16; ++j) {
+            size_t first = 16 - len;
+            s.align[len][j] = (j < first) ? (int8_t)0x80
+                                          : (int8_t)(lane + j - first);
+        }
+    }
+    return s;
+}
+
+static constexpr avx2_shuffles shuffles = make_avx2_shuffles();
+
+__attribute__((target("avx2")))
+inline bool avx2(const char* hdr, uint64_t& size)
+{
+    auto v = _mm_loadu_si128((const __m128i*)(hdr + tail_offset));
+    auto fmag_want = _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0,
+                                   0, 0, 0, 0, 0, 0, fmag[0], fmag[1]);
+    if ((_mm_movemask_epi8(_mm_cmpeq_epi8(v, fmag_want)) & 0xc000) != 0xc000)
+        return false;
+    auto spaces = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+    auto d = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+    auto digits = _mm_movemask_epi8(
+        _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d));
+    auto len = digit_count(spaces, digits);
+    if (!len)
+        return false;
+    auto order = _mm_load_si128((const __m128i*)shuffles.align[len]);
+    d = _mm_shuffle_epi8(d, order);
+    auto t = _mm_maddubs_epi16(d, _mm_setr_epi8(10, 1, 10, 1, 10, 1, 10, 1,
+                                                10, 1, 10, 1, 10, 1, 10, 1));
+    t = _mm_madd_epi16(t, _mm_setr_epi16(100, 1, 100, 1, 100, 1, 100, 1));
+    t = _mm_packus_epi32(t, t);
+    t = _mm_madd_epi16(t, _mm_setr_epi16(10000, 1, 10000, 1,
+                                         10000, 1, 10000, 1));
+    size = (uint64_t)(uint32_t)_mm_cvtsi128_si32(t) * 100000000
+         + (uint32_t)_mm_extract_epi32(t, 1);
+    return true;
+}
+
+#endif
+
+/* the best kernel this CPU can run */
+inline kernel select()
+{
+#if use_x86_scan
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return sse2;
+#endif
+    return scalar;
+}
+
+static const kernel best = select();
+
+struct member
+{
+    size_t header_offset;
+    uint64_t size;
+};
+
+/*
+ * Walk the member chain in `data` starting at `pos`, appending every member
+ * found to `out`. Members are laid out back to back, each padded to
+ * `alignment`. Returns false if a header doesn't check out.
+ */
+inline bool members(std::span<const std::byte> data, size_t pos,
+                    size_t alignment, std::vector<member>& out,
+                    kernel parse = best)
+{
+    auto base = (const char*)data.data();
+    uint64_t size;
+    while (pos + sizeof(ar_hdr) <= data.size()) {
+        if (!parse(base + pos, size))
+            return false;
+        out.push_back({ pos, size });
+        // a size that runs off the end of the input ends the walk
+        if (size > data.size() - pos - sizeof(ar_hdr))
+            break;
+        pos += sizeof(ar_hdr) + (size + alignment - 1) / alignment * alignment;
+    }
+    return true;
+}
+
+} // ::scan
+
+} // ::current
+
+} // ::common
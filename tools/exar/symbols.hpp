@@ -0,0 +1,255 @@
+/* This file is part of Polyglot.
+
+  Copyright (C) 2024, Battelle Energy Alliance, LLC ALL RIGHTS RESERVED
+
+  Polyglot is free software; you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation; either version 3, or (at your option) any later version.
+
+  Polyglot is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with
+  this software; if not see <http://www.gnu.org/licenses/>. */
+
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+/*
+ * Just enough of the ELF object format to pull the externally visible symbols
+ * out of an archive member so we can build an archive symbol index. We don't
+ * rely on the host's <elf.h> (macOS doesn't have one), so the handful of
+ * structures we need are spelled out here; the file's own data encoding is
+ * handled with the same `swap_endian` helpers the archive headers use.
+ */
+
+namespace elf {
+
+static constexpr std::string_view magic = "\x7f" "ELF";
+
+static constexpr uint8_t class32 = 1;
+static constexpr uint8_t class64 = 2;
+static constexpr uint8_t data_lsb = 1;
+static constexpr uint8_t data_msb = 2;
+
+static constexpr uint32_t sht_symtab = 2;
+
+static constexpr uint16_t shn_undef = 0;
+
+static constexpr uint8_t stb_global = 1;
+static constexpr uint8_t stb_weak = 2;
+static constexpr uint8_t stb_gnu_unique = 10;
+
+static constexpr uint8_t stt_section = 3;
+static constexpr uint8_t stt_file = 4;
+
+struct ident
+{
+    char     ei_magic[4];
+    uint8_t  ei_class;
+    uint8_t  ei_data;
+    uint8_t  ei_version;
+    uint8_t  ei_pad[9];
+};
+
+struct elf32
+{
+    struct ehdr
+    {
+        ident    e_ident;
+        uint16_t e_type;
+        uint16_t e_machine;
+        uint32_t e_version;
+        uint32_t e_entry;
+        uint32_t e_phoff;
+        uint32_t e_shoff;
+        uint32_t e_flags;
+        uint16_t e_ehsize;
+        uint16_t e_phentsize;
+        uint16_t e_phnum;
+        uint16_t e_shentsize;
+        uint16_t e_shnum;
+        uint16_t e_shstrndx;
+    };
+
+    struct shdr
+    {
+        uint32_t sh_name;
+        uint32_t sh_type;
+        uint32_t sh_flags;
+        uint32_t sh_addr;
+        uint32_t sh_offset;
+        uint32_t sh_size;
+        uint32_t sh_link;
+        uint32_t sh_info;
+        uint32_t sh_addralign;
+        uint32_t sh_entsize;
+    };
+
+    struct sym
+    {
+        uint32_t st_name;
+        uint32_t st_value;
+        uint32_t st_size;
+        uint8_t  st_info;
+        uint8_t  st_other;
+        uint16_t st_shndx;
+    };
+};
+
+struct elf64
+{
+    struct ehdr
+    {
+        ident    e_ident;
+        uint16_t e_type;
+        uint16_t e_machine;
+        uint32_t e_version;
+        uint64_t e_entry;
+        uint64_t e_phoff;
+        uint64_t e_shoff;
+        uint32_t e_flags;
+        uint16_t e_ehsize;
+        uint16_t e_phentsize;
+        uint16_t e_phnum;
+        uint16_t e_shentsize;
+        uint16_t e_shnum;
+        uint16_t e_shstrndx;
+    };
+
+    struct shdr
+    {
+        uint32_t sh_name;
+        uint32_t sh_type;
+        uint64_t sh_flags;
+        uint64_t sh_addr;
+        uint64_t sh_offset;
+        uint64_t sh_size;
+        uint32_t sh_link;
+        uint32_t sh_info;
+        uint64_t sh_addralign;
+        uint64_t sh_entsize;
+    };
+
+    struct sym
+    {
+        uint32_t st_name;
+        uint8_t  st_info;
+        uint8_t  st_other;
+        uint16_t st_shndx;
+        uint64_t st_value;
+        uint64_t st_size;
+    };
+};
+
+namespace detail {
+
+template <class T>
+bool peek(std::span<const std::byte> data, size_t offset, T& value)
+{
+    if ((offset > data.size()) || (sizeof(value) > data.size() - offset))
+        return false;
+    memcpy((void*)&value, data.data() + offset, sizeof(value));
+    return true;
+}
+
+template <class Elf, endian Endian>
+void defined_symbols(std::span<const std::byte> data,
+                     std::vector<std::string_view>& out)
+{
+    typename Elf::ehdr eh;
+    typename Elf::shdr sh, strsh;
+    typename Elf::sym sym;
+
+    if (!peek(data, 0, eh))
+        return;
+    size_t shoff = swap_endian<Endian>(eh.e_shoff);
+    size_t shentsize = swap_endian<Endian>(eh.e_shentsize);
+    size_t shnum = swap_endian<Endian>(eh.e_shnum);
+    if (shentsize < sizeof(sh))
+        return;
+
+    for (size_t i = 0; i < shnum; ++i) {
+        if (!peek(data, shoff + i * shentsize, sh))
+            return;
+        if (swap_endian<Endian>(sh.sh_type) != sht_symtab)
+            continue;
+        size_t link = swap_endian<Endian>(sh.sh_link);
+        if ((link >= shnum) || !peek(data, shoff + link * shentsize, strsh))
+            continue;
+
+        size_t stroff = swap_endian<Endian>(strsh.sh_offset);
+        size_t strsize = swap_endian<Endian>(strsh.sh_size);
+        if ((stroff > data.size()) || (strsize > data.size() - stroff))
+            continue;
+        std::string_view strtab { (const char*)data.data() + stroff, strsize };
+
+        size_t off = swap_endian<Endian>(sh.sh_offset);
+        size_t size = swap_endian<Endian>(sh.sh_size);
+        size_t entsize = swap_endian<Endian>(sh.sh_entsize);
+        if (entsize < sizeof(sym))
+            entsize = sizeof(sym);
+        // the first entry is always the reserved null symbol
+        for (size_t pos = entsize; pos + sizeof(sym) <= size; pos += entsize) {
+            if (!peek(data, off + pos, sym))
+                break;
+            uint8_t bind = sym.st_info >> 4;
+            uint8_t type = sym.st_info & 0xf;
+            if ((bind != stb_global) && (bind != stb_weak)
+                    && (bind != stb_gnu_unique))
+                continue;
+            if ((type == stt_section) || (type == stt_file))
+                continue;
+            if (swap_endian<Endian>(sym.st_shndx) == shn_undef)
+                continue;
+            size_t name = swap_endian<Endian>(sym.st_name);
+            if (!name || (name >= strtab.size()))
+                continue;
+            auto str = strtab.substr(name);
+            str = str.substr(0, str.find('\0'));
+            if (str.size())
+                out.push_back(str);
+        }
+    }
+}
+
+} // ::detail
+
+/*
+ * Append the names of every symbol an object file defines for the outside
+ * world (global, weak and unique bindings, including commons) to `out`. The
+ * views point into `data`. Returns the object's byte order, or nothing if it
+ * isn't an ELF file at all (in which case it contributes no symbols).
+ */
+inline std::optional<endian> defined_symbols(std::span<const std::byte> data,
+                                             std::vector<std::string_view>& out)
+{
+    ident id;
+
+    if (!detail::peek(data, 0, id)
+            || (std::string_view { id.ei_magic, 4 } != magic))
+        return {};
+    switch ((id.ei_class << 8) | id.ei_data)
+    {
+    case (class32 << 8) | data_lsb:
+        detail::defined_symbols<elf32, endian::little>(data, out);
+        return endian::little;
+    case (class32 << 8) | data_msb:
+        detail::defined_symbols<elf32, endian::big>(data, out);
+        return endian::big;
+    case (class64 << 8) | data_lsb:
+        detail::defined_symbols<elf64, endian::little>(data, out);
+        return endian::little;
+    case (class64 << 8) | data_msb:
+        detail::defined_symbols<elf64, endian::big>(data, out);
+        return endian::big;
+    }
+    return {};
+}
+
+} // ::elf